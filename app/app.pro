@@ -20,32 +20,44 @@ TARGET = perfparser
 SOURCES += main.cpp \
     perfaddresscache.cpp \
     perfattributes.cpp \
+    perfcfitable.cpp \
     perfheader.cpp \
     perffilesection.cpp \
     perffeatures.cpp \
     perfdata.cpp \
     perfunwind.cpp \
     perfregisterinfo.cpp \
+    perfspillfile.cpp \
+    perfstackvalues.cpp \
+    perfstringtable.cpp \
     perfstdin.cpp \
     perfsymboltable.cpp \
     perfelfmap.cpp \
     perfkallsyms.cpp \
+    perftimeindex.cpp \
     perftracingdata.cpp \
     perfdwarfdiecache.cpp
 
 HEADERS += \
     perfaddresscache.h \
     perfattributes.h \
+    perfcfitable.h \
     perfheader.h \
     perffilesection.h \
     perffeatures.h \
     perfdata.h \
     perfunwind.h \
     perfregisterinfo.h \
+    perfspillfile.h \
+    perfstackvalues.h \
+    perfstringtable.h \
     perfstdin.h \
     perfsymboltable.h \
     perfelfmap.h \
+    perfeventbuffer.h \
+    perfflathash.h \
     perfkallsyms.h \
+    perftimeindex.h \
     perftracingdata.h \
     perfdwarfdiecache.h \
     perfeucompat.h
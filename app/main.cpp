@@ -23,6 +23,7 @@
 #include "perffeatures.h"
 #include "perfheader.h"
 #include "perfregisterinfo.h"
+#include "perfstackvalues.h"
 #include "perfstdin.h"
 #include "perfunwind.h"
 
@@ -241,6 +242,13 @@ int main(int argc, char *argv[])
         QCoreApplication::translate("main", "Print statistics instead of converting the data."));
     parser.addOption(printStats);
 
+    QCommandLineOption printCacheStats(
+        QStringLiteral("print-cache-stats"),
+        QCoreApplication::translate("main",
+                                    "Print the hit rate of the address cache to stderr after"
+                                    " converting the data."));
+    parser.addOption(printCacheStats);
+
     QCommandLineOption bufferSize(
         QStringLiteral("buffer-size"),
         QCoreApplication::translate("main",
@@ -270,6 +278,27 @@ int main(int argc, char *argv[])
         QStringLiteral("max-buffer-size"), QString::number(1 << 20));
     parser.addOption(maxBufferSize);
 
+    QCommandLineOption maxStackBufferSize(
+        QStringLiteral("max-stack-buffer-size"),
+        QCoreApplication::translate("main",
+                                    "Maximum size in kilobytes of the stack snapshots kept in memory"
+                                    " while their samples wait in the event buffer. Stacks beyond"
+                                    " that are moved to a temporary file until they are analyzed."
+                                    " Stacks of files read with --input are not copied in the first"
+                                    " place. The default value is 0, which keeps all stacks in memory."),
+        QStringLiteral("max-stack-buffer-size"), QStringLiteral("0"));
+    parser.addOption(maxStackBufferSize);
+
+    QCommandLineOption outputBufferSize(
+        QStringLiteral("output-buffer-size"),
+        QCoreApplication::translate("main",
+                                    "Size of the output buffer in kilobytes. Analyzed events are"
+                                    " collected in this buffer and written out in one block once it"
+                                    " is full, or when the current event buffer has been processed."
+                                    " The default value is 1MB."),
+        QStringLiteral("output-buffer-size"), QString::number(1 << 10));
+    parser.addOption(outputBufferSize);
+
     QCommandLineOption maxFrames(
         QStringLiteral("max-frames"),
         QCoreApplication::translate("main",
@@ -280,6 +309,52 @@ int main(int argc, char *argv[])
         QStringLiteral("max-frames"), QStringLiteral("64"));
     parser.addOption(maxFrames);
 
+    QCommandLineOption unwindThreads(
+        QStringLiteral("unwind-threads"),
+        QCoreApplication::translate("main",
+                                    "Number of threads to use for DWARF stack unwinding."
+                                    " Samples of different processes are unwound in parallel,"
+                                    " the results are still written in time order."
+                                    " Default value is 1, which unwinds all samples in the main thread."),
+        QStringLiteral("unwind-threads"), QStringLiteral("1"));
+    parser.addOption(unwindThreads);
+
+    QCommandLineOption unwindMode(
+        QStringLiteral("unwind"),
+        QCoreApplication::translate("main",
+                                    "How to unwind user space stacks from the sampled registers and"
+                                    " stack snapshots: \"dwarf\" evaluates the DWARF call frame"
+                                    " information, \"fp\" follows the frame pointers, and \"auto\""
+                                    " follows the frame pointers and falls back to DWARF where the"
+                                    " frame pointer chain is broken. \"cfi\" applies the call frame"
+                                    " information directly where it only uses simple rules, and"
+                                    " falls back to DWARF otherwise. Default value is \"dwarf\"."),
+        QStringLiteral("mode"), QStringLiteral("dwarf"));
+    parser.addOption(unwindMode);
+
+    QCommandLineOption unwindCacheSize(
+        QStringLiteral("unwind-cache-size"),
+        QCoreApplication::translate("main",
+                                    "Maximum size in kilobytes of the unwinding results remembered"
+                                    " for all processes together, including copies of their stacks."
+                                    " Samples with the same registers and stack contents as an"
+                                    " earlier one reuse its frames instead of unwinding again."
+                                    " Default value is 32768, 0 disables the cache."),
+        QStringLiteral("unwind-cache-size"), QStringLiteral("32768"));
+    parser.addOption(unwindCacheSize);
+
+    QCommandLineOption maxStackValues(
+        QStringLiteral("max-stack-values"),
+        QCoreApplication::translate("main",
+                                    "Maximum number of stack values to remember per process."
+                                    " When unwinding needs memory that is not part of the current"
+                                    " stack snapshot, the value seen at the same address in an"
+                                    " earlier sample is used to guess the remaining frames."
+                                    " Beyond the limit, the oldest values are forgotten."
+                                    " Default value is 65536, 0 disables guessing from old values."),
+        QStringLiteral("max-stack-values"), QString::number(PerfStackValues::DefaultMaxSize));
+    parser.addOption(maxStackValues);
+
     QCommandLineOption customPerfMapPath(
         QStringLiteral("perf-map-path"),
         QCoreApplication::translate("main",
@@ -288,6 +363,94 @@ int main(int argc, char *argv[])
 
     parser.addOption(customPerfMapPath);
 
+    QCommandLineOption decompressAhead(
+        QStringLiteral("decompress-ahead"),
+        QCoreApplication::translate("main",
+                                    "Decompress the compressed records of perf.data files on a separate"
+                                    " thread, ahead of the analysis. Only files read with --input"
+                                    " benefit from this."));
+    parser.addOption(decompressAhead);
+
+    QCommandLineOption symbolCachePath(
+        QStringLiteral("symbol-cache"),
+        QCoreApplication::translate("main",
+                                    "Directory where symbol tables extracted from ELF files are stored"
+                                    " by build-id, to be reused by later runs. Only complete symbol"
+                                    " tables are stored. Disabled by default."),
+        QStringLiteral("path"));
+    parser.addOption(symbolCachePath);
+
+    QCommandLineOption timeFrom(
+        QStringLiteral("time-from"),
+        QCoreApplication::translate("main",
+                                    "Only analyze samples recorded at or after <time>, in"
+                                    " nanoseconds of the clock used by perf."),
+        QStringLiteral("time"));
+    parser.addOption(timeFrom);
+
+    QCommandLineOption timeTo(
+        QStringLiteral("time-to"),
+        QCoreApplication::translate("main",
+                                    "Only analyze samples recorded at or before <time>, in"
+                                    " nanoseconds of the clock used by perf."),
+        QStringLiteral("time"));
+    parser.addOption(timeTo);
+
+    QCommandLineOption pids(
+        QStringLiteral("pid"),
+        QCoreApplication::translate("main",
+                                    "Only analyze samples of the processes in the comma separated"
+                                    " list <pids>. Can be given multiple times."),
+        QStringLiteral("pids"));
+    parser.addOption(pids);
+
+    QCommandLineOption tids(
+        QStringLiteral("tid"),
+        QCoreApplication::translate("main",
+                                    "Only analyze samples of the threads in the comma separated"
+                                    " list <tids>. Can be given multiple times."),
+        QStringLiteral("tids"));
+    parser.addOption(tids);
+
+    QCommandLineOption cpus(
+        QStringLiteral("cpu"),
+        QCoreApplication::translate("main",
+                                    "Only analyze samples recorded on the CPUs in the comma"
+                                    " separated list <cpus>. Can be given multiple times."),
+        QStringLiteral("cpus"));
+    parser.addOption(cpus);
+
+    QCommandLineOption sampleRate(
+        QStringLiteral("sample-rate"),
+        QCoreApplication::translate("main",
+                                    "Only analyze every <n>th sample of each thread and event. The"
+                                    " periods of the analyzed samples are multiplied by <n>, so that"
+                                    " the costs are estimated for all samples."),
+        QStringLiteral("n"));
+    parser.addOption(sampleRate);
+
+    QCommandLineOption maxSamples(
+        QStringLiteral("max-samples"),
+        QCoreApplication::translate("main",
+                                    "Analyze at most <n> samples. With a time index, the sample rate"
+                                    " is raised to spread them over the whole time window. Without"
+                                    " one, only the first <n> samples that pass the other filters"
+                                    " are analyzed and the costs are not scaled up. Other events are"
+                                    " still processed."),
+        QStringLiteral("n"));
+    parser.addOption(maxSamples);
+
+    QCommandLineOption timeIndex(
+        QStringLiteral("time-index"),
+        QCoreApplication::translate("main",
+                                    "Use the time index in <file> to only read the parts of the"
+                                    " input that are needed for --time-from and --time-to. If"
+                                    " <file> doesn't exist or doesn't match the input, the whole"
+                                    " input is read and the index is written to <file>. Input in"
+                                    " pipe mode can't be indexed."),
+        QStringLiteral("file"));
+    parser.addOption(timeIndex);
+
     parser.process(app);
 
     auto outfile = initOutfile(parser, output);
@@ -308,6 +471,20 @@ int main(int argc, char *argv[])
         return InvalidOption;
     }
 
+    const quint64 maxStackBufferSizeValue = parser.value(maxStackBufferSize).toULongLong(&ok) * 1024;
+    if (!ok) {
+        qWarning() << "Failed to parse max-stack-buffer-size argument. Expected unsigned integer, got:"
+                   << parser.value(maxStackBufferSize);
+        return InvalidOption;
+    }
+
+    uint outputBufferSizeValue = parser.value(outputBufferSize).toUInt(&ok) * 1024;
+    if (!ok) {
+        qWarning() << "Failed to parse output-buffer-size argument. Expected unsigned integer, got:"
+                   << parser.value(outputBufferSize);
+        return InvalidOption;
+    }
+
     int maxFramesValue = parser.value(maxFrames).toInt(&ok);
     if (!ok) {
         qWarning() << "Failed to parse max-frames argument. Expected integer, got:"
@@ -315,6 +492,102 @@ int main(int argc, char *argv[])
         return InvalidOption;
     }
 
+    int unwindThreadsValue = parser.value(unwindThreads).toInt(&ok);
+    if (!ok || unwindThreadsValue < 1) {
+        qWarning() << "Failed to parse unwind-threads argument. Expected positive integer, got:"
+                   << parser.value(unwindThreads);
+        return InvalidOption;
+    }
+
+    PerfUnwind::UnwindMode unwindModeValue = PerfUnwind::DwarfUnwinding;
+    if (parser.value(unwindMode) == QLatin1String("fp")) {
+        unwindModeValue = PerfUnwind::FramePointerUnwinding;
+    } else if (parser.value(unwindMode) == QLatin1String("auto")) {
+        unwindModeValue = PerfUnwind::AutoUnwinding;
+    } else if (parser.value(unwindMode) == QLatin1String("cfi")) {
+        unwindModeValue = PerfUnwind::CfiUnwinding;
+    } else if (parser.value(unwindMode) != QLatin1String("dwarf")) {
+        qWarning() << "Failed to parse unwind argument. Expected \"dwarf\", \"fp\", \"auto\" or \"cfi\", got:"
+                   << parser.value(unwindMode);
+        return InvalidOption;
+    }
+
+    int unwindCacheSizeValue = parser.value(unwindCacheSize).toInt(&ok);
+    if (!ok || unwindCacheSizeValue < 0) {
+        qWarning() << "Failed to parse unwind-cache-size argument. Expected non-negative integer, got:"
+                   << parser.value(unwindCacheSize);
+        return InvalidOption;
+    }
+    // the cache counts its size in an int
+    unwindCacheSizeValue = qMin(unwindCacheSizeValue, std::numeric_limits<int>::max() / 1024) * 1024;
+
+    int maxStackValuesValue = parser.value(maxStackValues).toInt(&ok);
+    if (!ok || maxStackValuesValue < 0) {
+        qWarning() << "Failed to parse max-stack-values argument. Expected non-negative integer, got:"
+                   << parser.value(maxStackValues);
+        return InvalidOption;
+    }
+
+    PerfSampleFilter sampleFilter;
+    if (parser.isSet(timeFrom)) {
+        sampleFilter.timeFrom = parser.value(timeFrom).toULongLong(&ok);
+        if (!ok) {
+            qWarning() << "Failed to parse time-from argument. Expected unsigned integer, got:"
+                       << parser.value(timeFrom);
+            return InvalidOption;
+        }
+    }
+
+    if (parser.isSet(timeTo)) {
+        sampleFilter.timeTo = parser.value(timeTo).toULongLong(&ok);
+        if (!ok || sampleFilter.timeTo < sampleFilter.timeFrom) {
+            qWarning() << "Failed to parse time-to argument. Expected unsigned integer not less"
+                       << "than time-from, got:" << parser.value(timeTo);
+            return InvalidOption;
+        }
+    }
+
+    auto parseIds = [&parser](const QCommandLineOption &option, QSet<quint32> *ids) {
+        const QStringList values = parser.values(option);
+        for (const QString &value : values) {
+            const auto parts = value.split(QLatin1Char(','));
+            for (const QString &part : parts) {
+                bool ok = false;
+                ids->insert(part.trimmed().toUInt(&ok));
+                if (!ok) {
+                    qWarning() << "Failed to parse" << option.names().first()
+                               << "argument. Expected comma separated unsigned integers, got:"
+                               << value;
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    if (!parseIds(pids, &sampleFilter.pids) || !parseIds(tids, &sampleFilter.tids)
+            || !parseIds(cpus, &sampleFilter.cpus)) {
+        return InvalidOption;
+    }
+
+    if (parser.isSet(sampleRate)) {
+        sampleFilter.sampleRate = parser.value(sampleRate).toUInt(&ok);
+        if (!ok || sampleFilter.sampleRate == 0) {
+            qWarning() << "Failed to parse sample-rate argument. Expected positive integer, got:"
+                       << parser.value(sampleRate);
+            return InvalidOption;
+        }
+    }
+
+    if (parser.isSet(maxSamples)) {
+        sampleFilter.maxSamples = parser.value(maxSamples).toULongLong(&ok);
+        if (!ok) {
+            qWarning() << "Failed to parse max-samples argument. Expected unsigned integer, got:"
+                       << parser.value(maxSamples);
+            return InvalidOption;
+        }
+    }
+
     PerfUnwind unwind(outfile.get(), parser.value(sysroot),
                       parser.isSet(debug) ? parser.value(debug) : parser.value(sysroot) + parser.value(debug),
                       parser.value(extra), parser.value(appPath),
@@ -329,12 +602,32 @@ int main(int argc, char *argv[])
 
     unwind.setTargetEventBufferSize(targetEventBufferSize);
     unwind.setMaxEventBufferSize(maxEventBufferSize);
+    unwind.setOutputBufferSize(outputBufferSizeValue);
+    unwind.setMaxBufferedStackSize(maxStackBufferSizeValue);
     unwind.setMaxUnwindFrames(maxFramesValue);
+    unwind.setUnwindThreads(unwindThreadsValue);
+    unwind.setUnwindMode(unwindModeValue);
+    unwind.setUnwindCacheSize(unwindCacheSizeValue);
+    unwind.setMaxStackValues(maxStackValuesValue);
+
+    if (parser.isSet(symbolCachePath)) {
+        const auto path = parser.value(symbolCachePath);
+        if (!QDir().mkpath(path)) {
+            qWarning() << "Failed to create symbol cache directory" << path;
+            return InvalidOption;
+        }
+        unwind.setSymbolCachePath(path);
+    }
 
     PerfHeader header(infile.get());
     PerfAttributes attributes;
     PerfFeatures features;
     PerfData data(&unwind, &header, &attributes);
+    data.setDecompressAhead(parser.isSet(decompressAhead));
+    data.setSampleFilter(sampleFilter);
+    unwind.setPrintCacheStats(parser.isSet(printCacheStats));
+    if (parser.isSet(timeIndex))
+        data.setTimeIndexFile(parser.value(timeIndex));
 
     features.setArchitecture(parser.value(arch).toLatin1());
 
@@ -21,9 +21,18 @@
 
 #include "perfdwarfdiecache.h"
 
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+
 #include <algorithm>
 
 namespace {
+// "PSYM", bump the version whenever the layout of the cache files changes
+const quint32 s_symbolCacheMagic = 0x5053594d;
+const quint32 s_symbolCacheVersion = 1;
+
 quint64 relativeAddress(const PerfElfMap::ElfInfo& elf, quint64 addr)
 {
     Q_ASSERT(elf.isValid());
@@ -35,22 +44,36 @@ quint64 relativeAddress(const PerfElfMap::ElfInfo& elf, quint64 addr)
 }
 
 PerfAddressCache::AddressCacheEntry PerfAddressCache::find(const PerfElfMap::ElfInfo& elf, quint64 addr,
-                                                           OffsetAddressCache *invalidAddressCache) const
+                                                           OffsetAddressCache *invalidAddressCache)
 {
-    if (elf.isValid())
-        return m_cache.value(elf.originalPath).value(relativeAddress(elf, addr));
-    else
-        return invalidAddressCache->value(addr);
+    ++m_numLookups;
+
+    const OffsetAddressCache *cache = invalidAddressCache;
+    if (elf.isValid()) {
+        if (elf.originalPathId >= m_cache.size())
+            return {};
+        cache = &m_cache.at(elf.originalPathId);
+        addr = relativeAddress(elf, addr);
+    }
+
+    const AddressCacheEntry *entry = cache->find(addr);
+    if (!entry)
+        return {};
+    ++m_numHits;
+    return *entry;
 }
 
 void PerfAddressCache::cache(const PerfElfMap::ElfInfo& elf, quint64 addr,
                              PerfAddressCache::AddressCacheEntry entry,
                              OffsetAddressCache *invalidAddressCache)
 {
-    if (elf.isValid())
-        m_cache[elf.originalPath][relativeAddress(elf, addr)] = entry;
-    else
+    if (elf.isValid()) {
+        if (elf.originalPathId >= m_cache.size())
+            m_cache.resize(elf.originalPathId + 1);
+        m_cache[elf.originalPathId][relativeAddress(elf, addr)] = entry;
+    } else {
         (*invalidAddressCache)[addr] = entry;
+    }
 }
 
 static bool operator<(const PerfAddressCache::SymbolCacheEntry &lhs, const PerfAddressCache::SymbolCacheEntry &rhs)
@@ -69,6 +92,22 @@ static bool operator<(const PerfAddressCache::SymbolCacheEntry &lhs, quint64 add
 }
 
 
+QSharedPointer<ModuleDieRanges> PerfAddressCache::dieRanges(const QByteArray &buildId)
+{
+    auto &ranges = m_dieRanges[buildId];
+    if (!ranges)
+        ranges = QSharedPointer<ModuleDieRanges>::create();
+    return ranges;
+}
+
+QSharedPointer<PerfCfiTable> PerfAddressCache::cfiTable(const QByteArray &buildId)
+{
+    auto &table = m_cfiTables[buildId];
+    if (!table)
+        table = QSharedPointer<PerfCfiTable>::create();
+    return table;
+}
+
 bool PerfAddressCache::hasSymbolCache(const QByteArray &filePath) const
 {
     return m_symbolCache.contains(filePath);
@@ -137,3 +176,60 @@ PerfAddressCache::SymbolCache PerfAddressCache::extractSymbols(Dwfl_Module *modu
     }
     return cache;
 }
+
+bool PerfAddressCache::saveSymbolCache(const QString &fileName, const SymbolCache &cache, qint64 offsetDelta)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to open symbol cache file for writing" << fileName << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << s_symbolCacheMagic << s_symbolCacheVersion << quint32(cache.size());
+    for (const auto &entry : cache)
+        stream << quint64(entry.offset + offsetDelta) << entry.value << entry.size << entry.symname;
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "Failed to write symbol cache file" << fileName << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool PerfAddressCache::loadSymbolCache(const QString &fileName, SymbolCache *cache, qint64 offsetDelta)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    // The entries are copied into the cache, as the symbols get demangled in place on lookup.
+    // Reading the file in full is as fast as mapping it then.
+    QDataStream stream(&file);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint32 numEntries = 0;
+    stream >> magic >> version >> numEntries;
+    if (magic != s_symbolCacheMagic || version != s_symbolCacheVersion) {
+        qWarning() << "Ignoring incompatible symbol cache file" << fileName;
+        return false;
+    }
+
+    SymbolCache entries;
+    entries.reserve(static_cast<int>(qMin(numEntries, quint32(file.size() / 32))));
+    for (quint32 i = 0; i < numEntries && stream.status() == QDataStream::Ok; ++i) {
+        SymbolCacheEntry entry;
+        stream >> entry.offset >> entry.value >> entry.size >> entry.symname;
+        entry.offset += offsetDelta;
+        entries.append(entry);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << "Ignoring truncated symbol cache file" << fileName;
+        return false;
+    }
+
+    *cache = std::move(entries);
+    return true;
+}
@@ -21,9 +21,13 @@
 #define PERFADDRESSCACHE_H
 
 #include <QHash>
+#include <QSharedPointer>
 #include <QVector>
 
+#include "perfcfitable.h"
+#include "perfdwarfdiecache.h"
 #include "perfelfmap.h"
+#include "perfflathash.h"
 
 #include <libdwfl.h>
 
@@ -52,7 +56,7 @@ public:
         int locationId;
         bool isInterworking;
     };
-    using OffsetAddressCache = QHash<quint64, AddressCacheEntry>;
+    using OffsetAddressCache = PerfFlatHash<quint64, AddressCacheEntry>;
 
     struct SymbolCacheEntry
     {
@@ -76,10 +80,14 @@ public:
     using SymbolCache = QVector<SymbolCacheEntry>;
 
     AddressCacheEntry find(const PerfElfMap::ElfInfo& elf, quint64 addr,
-                           OffsetAddressCache *invalidAddressCache) const;
+                           OffsetAddressCache *invalidAddressCache);
     void cache(const PerfElfMap::ElfInfo& elf, quint64 addr,
                AddressCacheEntry entry, OffsetAddressCache *invalidAddressCache);
 
+    /// number of calls to @c find, and how many of them found an entry
+    quint64 numLookups() const { return m_numLookups; }
+    quint64 numHits() const { return m_numHits; }
+
     /// check if @c setSymbolCache was called for @p filePath already
     bool hasSymbolCache(const QByteArray &filePath) const;
     /// take @p cache, sort it and use it for symbol lookups in @p filePath
@@ -91,9 +99,25 @@ public:
     /// extract all symbols in @p module into a structure suitable to be passed to @p setSymbols
     static SymbolCache extractSymbols(Dwfl_Module *module, quint64 elfStart, bool isArmArch);
 
+    /// write @p cache to @p fileName, offsets are shifted by @p offsetDelta before writing
+    static bool saveSymbolCache(const QString &fileName, const SymbolCache &cache, qint64 offsetDelta = 0);
+    /// read a symbol cache written by @c saveSymbolCache from @p fileName into @p cache,
+    /// offsets are shifted by @p offsetDelta after reading
+    static bool loadSymbolCache(const QString &fileName, SymbolCache *cache, qint64 offsetDelta = 0);
+
+    /// @return the CU and subprogram ranges shared by all modules loaded from the file with @p buildId
+    QSharedPointer<ModuleDieRanges> dieRanges(const QByteArray &buildId);
+    /// @return the call frame information shared by all modules loaded from the file with @p buildId
+    QSharedPointer<PerfCfiTable> cfiTable(const QByteArray &buildId);
+
 private:
-    QHash<QByteArray, OffsetAddressCache> m_cache;
+    // indexed by the interned original path of the elf, see PerfUnwind::paths()
+    QVector<OffsetAddressCache> m_cache;
+    quint64 m_numLookups = 0;
+    quint64 m_numHits = 0;
     QHash<QByteArray, SymbolCache> m_symbolCache;
+    QHash<QByteArray, QSharedPointer<ModuleDieRanges>> m_dieRanges;
+    QHash<QByteArray, QSharedPointer<PerfCfiTable>> m_cfiTables;
 };
 
 QT_BEGIN_NAMESPACE
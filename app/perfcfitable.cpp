@@ -0,0 +1,147 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perfcfitable.h"
+
+#include <dwarf.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+namespace {
+bool toOffset(Dwarf_Sword value, qint32 *offset)
+{
+    if (value < std::numeric_limits<qint32>::min() || value > std::numeric_limits<qint32>::max())
+        return false;
+    *offset = static_cast<qint32>(value);
+    return true;
+}
+
+// libdw describes a CFA of register + offset as a single DW_OP_bregx, or DW_OP_bregN
+bool readCfa(Dwarf_Frame *frame, PerfCfiTable::Row *row)
+{
+    Dwarf_Op *ops = nullptr;
+    size_t numOps = 0;
+    if (dwarf_frame_cfa(frame, &ops, &numOps) != 0 || numOps != 1)
+        return false;
+
+    const Dwarf_Op &op = ops[0];
+    if (op.atom == DW_OP_bregx) {
+        row->cfaRegister = static_cast<quint16>(op.number);
+        return op.number <= std::numeric_limits<quint16>::max()
+                && toOffset(static_cast<Dwarf_Sword>(op.number2), &row->cfaOffset);
+    } else if (op.atom >= DW_OP_breg0 && op.atom <= DW_OP_breg31) {
+        row->cfaRegister = static_cast<quint16>(op.atom - DW_OP_breg0);
+        return toOffset(static_cast<Dwarf_Sword>(op.number), &row->cfaOffset);
+    }
+    return false;
+}
+
+// libdw describes an undefined register without ops, an unchanged one with an empty list of ops,
+// and one saved at CFA + offset as DW_OP_call_frame_cfa, optionally followed by DW_OP_plus_uconst.
+PerfCfiTable::Rule readRule(Dwarf_Frame *frame, int reg)
+{
+    PerfCfiTable::Rule rule;
+    Dwarf_Op opsMem[3];
+    Dwarf_Op *ops = nullptr;
+    size_t numOps = 0;
+    if (dwarf_frame_register(frame, reg, opsMem, &ops, &numOps) != 0)
+        return rule;
+
+    if (numOps == 0) {
+        rule.kind = ops ? PerfCfiTable::Rule::SameValue : PerfCfiTable::Rule::Undefined;
+    } else if (ops[0].atom == DW_OP_call_frame_cfa) {
+        if (numOps == 1) {
+            rule.kind = PerfCfiTable::Rule::CfaOffset;
+        } else if (numOps == 2 && ops[1].atom == DW_OP_plus_uconst) {
+            // negative offsets are stored as wrapped around unsigned numbers
+            if (toOffset(static_cast<Dwarf_Sword>(ops[1].number), &rule.offset))
+                rule.kind = PerfCfiTable::Rule::CfaOffset;
+        }
+    }
+    return rule;
+}
+
+PerfCfiTable::Row evaluateRow(Dwarf_Frame *frame, Dwarf_Addr bias, Dwarf_Addr moduleStart,
+                              int framePointerRegister)
+{
+    PerfCfiTable::Row row;
+    bool isSignalFrame = false;
+    const int returnAddressRegister = dwarf_frame_info(frame, &row.start, &row.end,
+                                                       &isSignalFrame);
+    row.start += bias - moduleStart;
+    row.end += bias - moduleStart;
+
+    if (returnAddressRegister < 0 || isSignalFrame || !readCfa(frame, &row)) {
+        row.isComplex = true;
+        return row;
+    }
+
+    row.returnAddressRegister = static_cast<quint16>(returnAddressRegister);
+    row.returnAddress = readRule(frame, returnAddressRegister);
+    row.framePointer = readRule(frame, framePointerRegister);
+    row.isComplex = row.returnAddress.kind == PerfCfiTable::Rule::Complex
+            || row.framePointer.kind == PerfCfiTable::Rule::Complex;
+    return row;
+}
+
+Dwarf_Frame *addrFrame(Dwarf_CFI *cfi, Dwarf_Addr bias, Dwarf_Addr pc)
+{
+    Dwarf_Frame *frame = nullptr;
+    if (!cfi || dwarf_cfi_addrframe(cfi, pc - bias, &frame) != 0)
+        return nullptr;
+    return frame;
+}
+}
+
+const PerfCfiTable::Row *PerfCfiTable::findRow(Dwfl_Module *module, Dwarf_Addr moduleStart,
+                                               Dwarf_Addr pc, int framePointerRegister)
+{
+    if (pc < moduleStart)
+        return nullptr;
+
+    const Dwarf_Addr offset = pc - moduleStart;
+    auto it = std::upper_bound(m_rows.begin(), m_rows.end(), offset,
+                               [](Dwarf_Addr offset, const Row &row) {
+                                   return offset < row.start;
+                               });
+    if (it != m_rows.begin() && offset < (it - 1)->end)
+        return &*(it - 1);
+
+    // Prefer .eh_frame, like dwfl does when unwinding.
+    Dwarf_Addr bias = 0;
+    Dwarf_Frame *frame = addrFrame(dwfl_module_eh_cfi(module, &bias), bias, pc);
+    if (!frame)
+        frame = addrFrame(dwfl_module_dwarf_cfi(module, &bias), bias, pc);
+    if (!frame)
+        return nullptr;
+
+    const Row row = evaluateRow(frame, bias, moduleStart, framePointerRegister);
+    free(frame);
+    if (offset < row.start || offset >= row.end)
+        return nullptr;
+
+    it = std::upper_bound(m_rows.begin(), m_rows.end(), row.start,
+                          [](Dwarf_Addr start, const Row &row) {
+                              return start < row.start;
+                          });
+    return &*m_rows.insert(it, row);
+}
@@ -0,0 +1,77 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#pragma once
+
+#include <libdwfl.h>
+
+#include <QVector>
+
+// Simplified call frame information of a file. Most compiler generated code computes the CFA as
+// a register plus an offset, and either keeps the return address and the frame pointer or saves
+// them at an offset from the CFA. Such rules can be applied without interpreting DWARF
+// expressions. Each row is evaluated by libdw once, when an address in its range is first looked
+// up, and then kept in an address-sorted table. The addresses are relative to the start of the
+// module, so that all processes that load the file can share the table.
+class PerfCfiTable
+{
+public:
+    struct Rule
+    {
+        enum Kind : quint8 {
+            Undefined,
+            SameValue,
+            CfaOffset, // saved at CFA + offset
+            Complex
+        };
+
+        Kind kind = Complex;
+        qint32 offset = 0;
+    };
+
+    struct Row
+    {
+        // relative to the module start
+        Dwarf_Addr start = 0;
+        Dwarf_Addr end = 0;
+        qint32 cfaOffset = 0;
+        quint16 cfaRegister = 0;
+        quint16 returnAddressRegister = 0;
+        Rule returnAddress;
+        Rule framePointer;
+
+        // If set, the rules can't be applied without dwfl, e.g. in signal frames.
+        bool isComplex = false;
+    };
+
+    // Find the rules for the absolute address @p pc in @p module, which starts at @p moduleStart.
+    // The frame pointer rule is for the DWARF register @p framePointerRegister. Returns nullptr if
+    // the module has no CFI for @p pc.
+    const Row *findRow(Dwfl_Module *module, Dwarf_Addr moduleStart, Dwarf_Addr pc,
+                       int framePointerRegister);
+
+private:
+    QVector<Row> m_rows;
+};
+
+QT_BEGIN_NAMESPACE
+Q_DECLARE_TYPEINFO(PerfCfiTable::Rule, Q_MOVABLE_TYPE);
+Q_DECLARE_TYPEINFO(PerfCfiTable::Row, Q_MOVABLE_TYPE);
+QT_END_NAMESPACE
@@ -23,16 +23,173 @@
 #include "perfunwind.h"
 
 #include <QDebug>
-
+#include <QFileDevice>
+#include <QMutex>
+#include <QQueue>
+#include <QScopeGuard>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <cstring>
 #include <limits>
+#include <memory>
 
 static const int intMax = std::numeric_limits<int>::max();
 
+#if HAVE_ZSTD
+// Decompresses the PERF_RECORD_COMPRESSED records of a mapped data section on a separate thread,
+// so that decompression overlaps with parsing and unwinding. perf compresses all records into a
+// single zstd stream, so they still have to be decompressed one after the other.
+class PerfDecompressAhead
+{
+public:
+    PerfDecompressAhead(const uchar *data, qint64 size, QDataStream::ByteOrder byteOrder, quint32 mmapLen);
+    ~PerfDecompressAhead();
+
+    // Waits for the data of the next compressed record. Returns false on errors.
+    bool takeNext(QByteArray *decompressed);
+
+private:
+    static const int s_maxQueuedChunks = 16;
+
+    struct Chunk
+    {
+        QByteArray data;
+        bool isValid;
+    };
+
+    void run();
+    bool enqueue(const Chunk &chunk);
+
+    const uchar *m_data;
+    qint64 m_size;
+    QDataStream::ByteOrder m_byteOrder;
+    quint32 m_mmapLen;
+
+    QMutex m_mutex;
+    QWaitCondition m_chunkAvailable;
+    QWaitCondition m_spaceAvailable;
+    QQueue<Chunk> m_chunks;
+    bool m_finished = false;
+    bool m_stopped = false;
+    QThread *m_thread;
+};
+
+PerfDecompressAhead::PerfDecompressAhead(const uchar *data, qint64 size, QDataStream::ByteOrder byteOrder,
+                                         quint32 mmapLen)
+    : m_data(data), m_size(size), m_byteOrder(byteOrder), m_mmapLen(mmapLen)
+    , m_thread(QThread::create([this]() { run(); }))
+{
+    m_thread->start();
+}
+
+PerfDecompressAhead::~PerfDecompressAhead()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopped = true;
+        m_spaceAvailable.wakeAll();
+    }
+    m_thread->wait();
+    delete m_thread;
+}
+
+bool PerfDecompressAhead::takeNext(QByteArray *decompressed)
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_chunks.isEmpty() && !m_finished)
+        m_chunkAvailable.wait(&m_mutex);
+
+    if (m_chunks.isEmpty()) {
+        qWarning() << "compressed record was not decompressed ahead of time";
+        return false;
+    }
+
+    const Chunk chunk = m_chunks.dequeue();
+    m_spaceAvailable.wakeAll();
+    *decompressed = chunk.data;
+    return chunk.isValid;
+}
+
+bool PerfDecompressAhead::enqueue(const Chunk &chunk)
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_stopped && m_chunks.size() >= s_maxQueuedChunks)
+        m_spaceAvailable.wait(&m_mutex);
+    if (m_stopped)
+        return false;
+
+    m_chunks.enqueue(chunk);
+    m_chunkAvailable.wakeAll();
+    return true;
+}
+
+void PerfDecompressAhead::run()
+{
+    ZSTD_DStream *dstream = ZSTD_createDStream();
+    ZSTD_initDStream(dstream);
+
+    // Only walk the top level records, the parser reports any inconsistencies it finds there.
+    const quint16 headerSize = PerfEventHeader::fixedLength();
+    qint64 pos = 0;
+    while (pos + headerSize <= m_size) {
+        PerfEventHeader header;
+        {
+            const QByteArray raw = QByteArray::fromRawData(reinterpret_cast<const char *>(m_data + pos),
+                                                           headerSize);
+            QDataStream stream(raw);
+            stream.setByteOrder(m_byteOrder);
+            stream >> header;
+        }
+        if (header.size < headerSize || pos + header.size > m_size)
+            break;
+
+        if (header.type == PERF_RECORD_COMPRESSED) {
+            Chunk chunk{QByteArray(static_cast<int>(m_mmapLen), Qt::Uninitialized), true};
+            ZSTD_inBuffer in = {m_data + pos + headerSize, static_cast<size_t>(header.size - headerSize), 0};
+            ZSTD_outBuffer out = {chunk.data.data(), static_cast<size_t>(chunk.data.size()), 0};
+            while (in.pos < in.size) {
+                if (out.pos == out.size) {
+                    chunk.data.resize(chunk.data.size() * 2);
+                    out.dst = chunk.data.data();
+                    out.size = static_cast<size_t>(chunk.data.size());
+                }
+                const auto err = ZSTD_decompressStream(dstream, &out, &in);
+                if (ZSTD_isError(err)) {
+                    qWarning() << "ZSTD decompression failed:" << ZSTD_getErrorName(err);
+                    chunk.isValid = false;
+                    break;
+                }
+            }
+            chunk.data.resize(static_cast<int>(out.pos));
+
+            if (!enqueue(chunk) || !chunk.isValid)
+                break;
+        }
+
+        pos += header.size;
+    }
+
+    ZSTD_freeDStream(dstream);
+
+    QMutexLocker locker(&m_mutex);
+    m_finished = true;
+    m_chunkAvailable.wakeAll();
+}
+#endif
+
 PerfData::PerfData(PerfUnwind *destination, const PerfHeader *header, PerfAttributes *attributes) :
     m_source(nullptr), m_destination(destination), m_header(header), m_attributes(attributes)
 {
 }
 
+void PerfData::setSampleFilter(const PerfSampleFilter &filter)
+{
+    m_sampleFilter = filter;
+    m_sampleRate = filter.sampleRate;
+    m_destination->setPeriodScale(filter.sampleRate);
+}
+
 PerfData::~PerfData()
 {
 #if HAVE_ZSTD
@@ -106,6 +263,91 @@ const char* perfEventToString(quint32 type)
     return "unknown type";
 }
 
+PerfData::SampleFields PerfData::peekSample(QDataStream &stream, quint16 contentSize,
+                                            int idOffset) const
+{
+    // The fields we filter by come before the variable sized parts of the sample, see
+    // PERF_RECORD_SAMPLE above. Only peek at those, so that rejected samples aren't parsed at all.
+    SampleFields result;
+    char data[8 * sizeof(quint64)];
+    const qint64 peeked = stream.device()->peek(data, qMin(static_cast<qint64>(contentSize),
+                                                           static_cast<qint64>(sizeof(data))));
+    if (peeked <= 0)
+        return result;
+
+    QDataStream fields(QByteArray::fromRawData(data, static_cast<int>(peeked)));
+    fields.setByteOrder(stream.byteOrder());
+
+    const PerfEventAttributes *attributes = &m_attributes->globalAttributes();
+    if (idOffset >= 0) {
+        quint64 id = 0;
+        fields.skipRawData(idOffset);
+        fields >> id;
+        attributes = &m_attributes->attributes(id);
+        fields.device()->seek(0);
+    }
+    result.sampleType = attributes->sampleType();
+    result.eventType = attributes->type();
+    result.eventConfig = attributes->config();
+
+    const quint64 sampleType = result.sampleType;
+    if (sampleType & PerfEventAttributes::SAMPLE_IDENTIFIER)
+        fields.skipRawData(sizeof(quint64));
+    if (sampleType & PerfEventAttributes::SAMPLE_IP)
+        fields.skipRawData(sizeof(quint64));
+    if (sampleType & PerfEventAttributes::SAMPLE_TID)
+        fields >> result.pid >> result.tid;
+    if (sampleType & PerfEventAttributes::SAMPLE_TIME)
+        fields >> result.time;
+    if (sampleType & PerfEventAttributes::SAMPLE_ADDR)
+        fields.skipRawData(sizeof(quint64));
+    if (sampleType & PerfEventAttributes::SAMPLE_ID)
+        fields.skipRawData(sizeof(quint64));
+    if (sampleType & PerfEventAttributes::SAMPLE_STREAM_ID)
+        fields.skipRawData(sizeof(quint64));
+    if (sampleType & PerfEventAttributes::SAMPLE_CPU)
+        fields >> result.cpu;
+
+    result.isValid = fields.status() == QDataStream::Ok;
+    return result;
+}
+
+bool PerfData::acceptSample(const SampleFields &fields)
+{
+    // Leave broken samples to the regular parser, which will complain about them, but still
+    // count them against the sample rate and the maximum below.
+    const quint64 sampleType = fields.isValid ? fields.sampleType : 0;
+    if (sampleType & PerfEventAttributes::SAMPLE_TID) {
+        if (!m_sampleFilter.pids.isEmpty() && !m_sampleFilter.pids.contains(fields.pid))
+            return false;
+        if (!m_sampleFilter.tids.isEmpty() && !m_sampleFilter.tids.contains(fields.tid))
+            return false;
+    }
+    if ((sampleType & PerfEventAttributes::SAMPLE_TIME)
+            && (fields.time < m_sampleFilter.timeFrom || fields.time > m_sampleFilter.timeTo)) {
+        return false;
+    }
+    if ((sampleType & PerfEventAttributes::SAMPLE_CPU)
+            && !m_sampleFilter.cpus.isEmpty() && !m_sampleFilter.cpus.contains(fields.cpu)) {
+        return false;
+    }
+
+    if (m_sampleRate > 1) {
+        DecimationKey key;
+        if (fields.isValid) {
+            key.tid = fields.tid;
+            key.type = fields.eventType;
+            key.config = fields.eventConfig;
+        }
+        if (m_numFilteredSamples[key]++ % m_sampleRate != 0)
+            return false;
+    }
+    if (m_numKeptSamples >= m_sampleFilter.maxSamples)
+        return false;
+    ++m_numKeptSamples;
+    return true;
+}
+
 PerfData::ReadStatus PerfData::processEvents(QDataStream &stream)
 {
     const quint16 headerSize = PerfEventHeader::fixedLength();
@@ -138,6 +380,11 @@ PerfData::ReadStatus PerfData::processEvents(QDataStream &stream)
 
     const auto oldPos = stream.device()->isSequential() ? 0 : stream.device()->pos();
 
+    if (m_buildTimeIndex && m_eventHeader.type != PERF_RECORD_SAMPLE
+            && m_eventHeader.type != PERF_RECORD_FINISHED_ROUND) {
+        m_timeIndex.addStateEvent();
+    }
+
     switch (m_eventHeader.type) {
     case PERF_RECORD_MMAP: {
         PerfRecordMmap mmap(&m_eventHeader, sampleType, sampleIdAll);
@@ -158,23 +405,54 @@ PerfData::ReadStatus PerfData::processEvents(QDataStream &stream)
         break;
     }
     case PERF_RECORD_SAMPLE: {
-        if (sampleIdAll && idOffset >= 0) {
-            QByteArray buffer(contentSize, Qt::Uninitialized);
-            stream.readRawData(buffer.data(), contentSize);
-            QDataStream contentStream(buffer);
-            contentStream.setByteOrder(stream.byteOrder());
+        if (m_skipSamples) {
+            stream.skipRawData(contentSize);
+            break;
+        }
 
-            Q_ASSERT(!contentStream.device()->isSequential());
+        if (m_buildTimeIndex || !m_sampleFilter.isEmpty()) {
+            const SampleFields fields = peekSample(stream, contentSize, sampleIdAll ? idOffset : -1);
+            if (m_buildTimeIndex) {
+                if (fields.isValid && (fields.sampleType & PerfEventAttributes::SAMPLE_TIME))
+                    m_timeIndex.addSample(fields.time);
+                else
+                    m_timeIndex.addUntimedSample();
+            }
+            if (!acceptSample(fields)) {
+                stream.skipRawData(contentSize);
+                break;
+            }
+        }
 
+        if (sampleIdAll && idOffset >= 0) {
             // peek into the data structure to find the actual ID. Horrible.
             quint64 id;
-            qint64 prevPos = contentStream.device()->pos();
-            contentStream.device()->seek(prevPos + idOffset);
-            contentStream >> id;
-            contentStream.device()->seek(prevPos);
+            if (stream.device()->isSequential()) {
+                QByteArray buffer(contentSize, Qt::Uninitialized);
+                stream.readRawData(buffer.data(), contentSize);
+                QDataStream contentStream(buffer);
+                contentStream.setByteOrder(stream.byteOrder());
+
+                Q_ASSERT(!contentStream.device()->isSequential());
+
+                qint64 prevPos = contentStream.device()->pos();
+                contentStream.device()->seek(prevPos + idOffset);
+                contentStream >> id;
+                contentStream.device()->seek(prevPos);
+
+                PerfRecordSample sample(&m_eventHeader, &m_attributes->attributes(id));
+                contentStream >> sample;
+                m_destination->sample(sample);
+                break;
+            }
+
+            // We can seek back, no need to copy the whole sample just to find the ID.
+            stream.device()->seek(oldPos + idOffset);
+            stream >> id;
+            stream.device()->seek(oldPos);
 
             PerfRecordSample sample(&m_eventHeader, &m_attributes->attributes(id));
-            contentStream >> sample;
+            stream >> sample;
             m_destination->sample(sample);
         } else {
             PerfRecordSample sample(&m_eventHeader, &attrs);
@@ -241,6 +519,7 @@ PerfData::ReadStatus PerfData::processEvents(QDataStream &stream)
     }
     case PERF_RECORD_FINISHED_ROUND: {
         m_destination->finishedRound();
+        m_roundFinished = m_buildTimeIndex;
         if (contentSize != 0) {
             qWarning() << "FINISHED_ROUND with non-zero content size detected"
                        << contentSize;
@@ -278,30 +557,44 @@ PerfData::ReadStatus PerfData::processEvents(QDataStream &stream)
             m_compressedBuffer.resize(std::numeric_limits<quint16>::max());
         }
 
-        // load compressed data into contiguous array
-        stream.readRawData(m_compressedBuffer.data(), contentSize);
-        ZSTD_inBuffer in = {m_compressedBuffer.constData(), static_cast<size_t>(contentSize), 0};
-
-        // setup decompression buffer which may contain data from a previous compressed record
-        // i.e. one where we had to Rerun. the decompression can add at most mmap_len data on top
-        m_decompressBuffer.resize(static_cast<int>(m_compressed.mmap_len + m_remaininingDecompressedDataSize));
-        auto outBuffer = m_decompressBuffer.data() + m_remaininingDecompressedDataSize;
-        auto outBufferSize = static_cast<size_t>(m_decompressBuffer.size() - m_remaininingDecompressedDataSize);
-        ZSTD_outBuffer out = {outBuffer, outBufferSize, 0};
-
-        // now actually decompress the record data
-        while (in.pos < in.size) {
-            const auto err = ZSTD_decompressStream(m_zstdDstream, &out, &in);
-            if (ZSTD_isError(err)) {
-                qWarning() << "ZSTD decompression failed:" << ZSTD_getErrorName(err);
+        // nested records are never compressed, so only the records of the mapped data section
+        // itself have been decompressed ahead of time
+        if (m_decompressAhead && qobject_cast<PerfMappedBuffer *>(stream.device())) {
+            QByteArray decompressed;
+            if (!m_decompressAhead->takeNext(&decompressed))
                 return SignalError;
+            stream.skipRawData(contentSize);
+
+            // append to the data left over from a previous compressed record, see below
+            m_decompressBuffer.resize(m_remaininingDecompressedDataSize + decompressed.size());
+            std::memcpy(m_decompressBuffer.data() + m_remaininingDecompressedDataSize, decompressed.constData(),
+                        static_cast<size_t>(decompressed.size()));
+        } else {
+            // load compressed data into contiguous array
+            stream.readRawData(m_compressedBuffer.data(), contentSize);
+            ZSTD_inBuffer in = {m_compressedBuffer.constData(), static_cast<size_t>(contentSize), 0};
+
+            // setup decompression buffer which may contain data from a previous compressed record
+            // i.e. one where we had to Rerun. the decompression can add at most mmap_len data on top
+            m_decompressBuffer.resize(static_cast<int>(m_compressed.mmap_len + m_remaininingDecompressedDataSize));
+            auto outBuffer = m_decompressBuffer.data() + m_remaininingDecompressedDataSize;
+            auto outBufferSize = static_cast<size_t>(m_decompressBuffer.size() - m_remaininingDecompressedDataSize);
+            ZSTD_outBuffer out = {outBuffer, outBufferSize, 0};
+
+            // now actually decompress the record data
+            while (in.pos < in.size) {
+                const auto err = ZSTD_decompressStream(m_zstdDstream, &out, &in);
+                if (ZSTD_isError(err)) {
+                    qWarning() << "ZSTD decompression failed:" << ZSTD_getErrorName(err);
+                    return SignalError;
+                }
+                out.dst = outBuffer + out.pos;
+                out.size = outBufferSize - out.pos;
             }
-            out.dst = outBuffer + out.pos;
-            out.size = outBufferSize - out.pos;
-        }
 
-        // then resize the buffer to final size, which may be less than mmap_len
-        m_decompressBuffer.resize(static_cast<int>(out.pos + m_remaininingDecompressedDataSize));
+            // then resize the buffer to final size, which may be less than mmap_len
+            m_decompressBuffer.resize(static_cast<int>(out.pos + m_remaininingDecompressedDataSize));
+        }
         // reset this now that we start to parse from the start of the buffer again
         m_remaininingDecompressedDataSize = 0;
 
@@ -398,32 +691,177 @@ PerfData::ReadStatus PerfData::doRead()
     } else if (m_source->isSequential()) {
         qWarning() << "cannot read non-stream format from stream";
         returnCode = SignalError;
-    } else if (!m_source->seek(m_header->dataOffset())) {
-        qWarning() << "cannot seek to" << m_header->dataOffset();
-        returnCode = SignalError;
     } else {
-        const auto dataOffset = m_header->dataOffset();
-        const auto dataSize = m_header->dataSize();
-        const auto endOfDataSection = dataOffset + dataSize;
+        const QVector<PerfTimeIndex::Range> ranges = timeIndexRanges();
+        if (const uchar *mapped = mapDataSection())
+            returnCode = doReadMapped(mapped, m_header->dataSize(), ranges);
+        else
+            returnCode = doReadSeekable(ranges);
+
+        if (m_buildTimeIndex) {
+            if (returnCode == SignalFinished) {
+                m_timeIndex.finishRound(m_header->dataSize());
+                m_timeIndex.save(m_timeIndexFile, sourceFileName(), m_header->dataOffset(),
+                                 m_header->dataSize());
+            }
+            m_buildTimeIndex = false;
+        }
+    }
 
-        m_destination->sendProgress(static_cast<float>(m_source->pos() - dataOffset) / static_cast<float>(dataSize));
-        const qint64 posDeltaBetweenProgress = dataSize / 100;
-        qint64 nextProgressAt = m_source->pos() + posDeltaBetweenProgress;
+    return returnCode;
+}
 
-        while (m_source->pos() < endOfDataSection) {
-            if (processEvents(stream) != SignalFinished) {
-                returnCode = SignalError;
-                break;
+QString PerfData::sourceFileName() const
+{
+    const auto *file = qobject_cast<const QFileDevice *>(m_source);
+    return file ? file->fileName() : QString();
+}
+
+QVector<PerfTimeIndex::Range> PerfData::timeIndexRanges()
+{
+    const QVector<PerfTimeIndex::Range> all = {{0, m_header->dataSize(), false}};
+    if (m_timeIndexFile.isEmpty())
+        return all;
+
+    // The index is checked against the contents of the file.
+    const QString dataFileName = sourceFileName();
+    if (dataFileName.isEmpty()) {
+        qWarning() << "Ignoring the time index, as the input is not a file";
+        return all;
+    }
+
+    if (m_timeIndex.load(m_timeIndexFile, dataFileName, m_header->dataOffset(),
+                         m_header->dataSize())) {
+        const QVector<PerfTimeIndex::Range> ranges
+                = m_timeIndex.ranges(m_sampleFilter.timeFrom, m_sampleFilter.timeTo);
+
+        // Spread the samples we may keep over the whole window, rather than cutting it short.
+        if (m_sampleFilter.maxSamples > 0
+                && m_sampleFilter.maxSamples != std::numeric_limits<quint64>::max()) {
+            const quint64 numSamples = m_timeIndex.numSamples(ranges);
+            const quint64 sampleRate = (numSamples + m_sampleFilter.maxSamples - 1)
+                    / m_sampleFilter.maxSamples;
+            if (sampleRate > m_sampleRate) {
+                m_sampleRate = static_cast<quint32>(
+                            qMin(sampleRate, quint64(std::numeric_limits<quint32>::max())));
+                m_destination->setPeriodScale(m_sampleRate);
+            }
+        }
+        return ranges;
+    }
+
+    // build it while reading the whole data section
+    m_timeIndex.clear();
+    m_buildTimeIndex = true;
+    return all;
+}
+
+PerfData::ReadStatus PerfData::doReadSeekable(const QVector<PerfTimeIndex::Range> &ranges)
+{
+    QDataStream stream(m_source);
+    stream.setByteOrder(m_header->byteOrder());
+
+    const auto dataOffset = m_header->dataOffset();
+    const auto dataSize = m_header->dataSize();
+
+    m_destination->sendProgress(0);
+    const qint64 posDeltaBetweenProgress = dataSize / 100;
+    qint64 nextProgressAt = posDeltaBetweenProgress;
+
+    for (const PerfTimeIndex::Range &range : ranges) {
+        if (!m_source->seek(dataOffset + range.begin)) {
+            qWarning() << "cannot seek to" << dataOffset + range.begin;
+            return SignalError;
+        }
+
+        m_skipSamples = range.statesOnly;
+        auto resetSkipSamples = qScopeGuard([this]() { m_skipSamples = false; });
+        while (m_source->pos() < dataOffset + range.end) {
+            if (processEvents(stream) != SignalFinished)
+                return SignalError;
+
+            const qint64 pos = m_source->pos() - dataOffset;
+            if (m_roundFinished) {
+                m_timeIndex.finishRound(pos);
+                m_roundFinished = false;
             }
-            if (m_source->pos() >= nextProgressAt) {
-                m_destination->sendProgress(static_cast<float>(m_source->pos() - dataOffset)
-                                            / static_cast<float>(dataSize));
+            if (pos >= nextProgressAt) {
+                m_destination->sendProgress(static_cast<float>(pos) / static_cast<float>(dataSize));
                 nextProgressAt += posDeltaBetweenProgress;
             }
         }
     }
 
-    return returnCode;
+    return SignalFinished;
+}
+
+const uchar *PerfData::mapDataSection() const
+{
+    // Only plain files can be mapped. The mapping is owned by the file and stays valid until the
+    // file is closed, which is after the unwinder has processed all the samples.
+    auto *file = qobject_cast<QFileDevice *>(m_source);
+    if (!file || m_header->dataSize() <= 0)
+        return nullptr;
+    return file->map(m_header->dataOffset(), m_header->dataSize());
+}
+
+PerfData::ReadStatus PerfData::doReadMapped(const uchar *data, qint64 size,
+                                            const QVector<PerfTimeIndex::Range> &ranges)
+{
+    // QBuffer can't address more than 2GB with Qt5. Parse huge data sections in windows which
+    // extend by the maximum record size beyond the point where we switch to the next one. That
+    // way the last record starting in a window is always complete.
+    const qint64 maxRecordSize = std::numeric_limits<quint16>::max();
+    const qint64 windowSize = 1 << 30;
+
+#if HAVE_ZSTD
+    std::unique_ptr<PerfDecompressAhead> decompressAhead;
+    if (m_decompressAheadEnabled && m_header->hasFeature(PerfHeader::COMPRESSED) && m_compressed.mmap_len) {
+        decompressAhead = std::make_unique<PerfDecompressAhead>(data, size, m_header->byteOrder(),
+                                                                m_compressed.mmap_len);
+    }
+    m_decompressAhead = decompressAhead.get();
+    auto resetDecompressAhead = qScopeGuard([this]() { m_decompressAhead = nullptr; });
+#endif
+
+    m_destination->sendProgress(0);
+    const qint64 posDeltaBetweenProgress = size / 100;
+    qint64 nextProgressAt = posDeltaBetweenProgress;
+
+    // The compressed records are never skipped, see PerfTimeIndex, so the records decompressed
+    // ahead of time are still taken in order.
+    for (const PerfTimeIndex::Range &range : ranges) {
+        m_skipSamples = range.statesOnly;
+        auto resetSkipSamples = qScopeGuard([this]() { m_skipSamples = false; });
+
+        qint64 windowStart = range.begin;
+        while (windowStart < range.end) {
+            const qint64 windowEnd = qMin(range.end, windowStart + windowSize);
+            const qint64 bufferEnd = qMin(size, windowEnd + maxRecordSize);
+            PerfMappedBuffer buffer(data + windowStart, static_cast<int>(bufferEnd - windowStart));
+            QDataStream stream(&buffer);
+            stream.setByteOrder(m_header->byteOrder());
+
+            while (windowStart + buffer.pos() < windowEnd) {
+                if (processEvents(stream) != SignalFinished)
+                    return SignalError;
+
+                const qint64 pos = windowStart + buffer.pos();
+                if (m_roundFinished) {
+                    m_timeIndex.finishRound(pos);
+                    m_roundFinished = false;
+                }
+                if (pos >= nextProgressAt) {
+                    m_destination->sendProgress(static_cast<float>(pos) / static_cast<float>(size));
+                    nextProgressAt += posDeltaBetweenProgress;
+                }
+            }
+
+            windowStart += buffer.pos();
+        }
+    }
+
+    return SignalFinished;
 }
 
 void PerfData::read()
@@ -467,6 +905,22 @@ void PerfData::finishReading()
     }
 }
 
+PerfMappedBuffer::PerfMappedBuffer(const uchar *data, int size, QObject *parent)
+    : QBuffer(parent)
+{
+    setData(QByteArray::fromRawData(reinterpret_cast<const char *>(data), size));
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+const char *PerfMappedBuffer::readView(int length)
+{
+    const qint64 position = pos();
+    if (length < 0 || size() - position < length)
+        return nullptr;
+    seek(position + length);
+    return data().constData() + position;
+}
+
 PerfRecordMmap::PerfRecordMmap(PerfEventHeader *header, quint64 sampleType, bool sampleIdAll) :
     PerfRecord(header, sampleType, sampleIdAll), m_pid(0), m_tid(0), m_addr(0), m_len(0), m_pgoff(0)
 {
@@ -622,16 +1076,30 @@ PerfRecordSample::PerfRecordSample(const PerfEventHeader *header,
 {
 }
 
+void PerfRecordSample::setUserStackSpilled(qint64 offset)
+{
+    Q_ASSERT(ownsUserStack());
+    m_spilledUserStackOffset = offset;
+    m_spilledUserStackSize = m_userStack.size();
+    m_userStack = QByteArray();
+}
+
+void PerfRecordSample::restoreUserStack(const QByteArray &userStack)
+{
+    Q_ASSERT(isUserStackSpilled());
+    m_userStack = userStack;
+    m_spilledUserStackOffset = -1;
+    m_spilledUserStackSize = 0;
+}
+
 quint64 PerfRecordSample::registerValue(int reg) const
 {
     Q_ASSERT(reg >= 0);
     Q_ASSERT(m_registerAbi && m_registerMask & (1ull << reg));
 
-    int index = 0;
-    for (int i = 0; i < reg; i++) {
-        if (m_registerMask & (1ull << i))
-            index++;
-    }
+    // The registers are stored in the order of their bits in the mask, so the index is the number
+    // of lower bits set.
+    const int index = static_cast<int>(qPopulationCount(m_registerMask & ((1ull << reg) - 1)));
 
     if (index < m_registers.length()) {
         return m_registers[index];
@@ -648,6 +1116,9 @@ QDataStream &operator>>(QDataStream &stream, PerfRecordSample &record)
     const quint64 sampleType = record.m_sampleId.sampleType();
     const auto withLostFormat = record.m_readFormat & PerfEventAttributes::FORMAT_LOST;
 
+    // when reading from a mapped file, refer to the raw data and stack snapshots instead of copying
+    auto *mapped = qobject_cast<PerfMappedBuffer *>(stream.device());
+
     if (sampleType & PerfEventAttributes::SAMPLE_IDENTIFIER)
         stream >> record.m_sampleId.m_id;
     if (sampleType & PerfEventAttributes::SAMPLE_IP)
@@ -712,6 +1183,8 @@ QDataStream &operator>>(QDataStream &stream, PerfRecordSample &record)
             qWarning() << "Excessively long raw data section" << rawSize;
             stream.skipRawData(intMax);
             stream.skipRawData(static_cast<int>(rawSize - intMax));
+        } else if (const char *view = mapped ? mapped->readView(static_cast<int>(rawSize)) : nullptr) {
+            record.m_rawData = QByteArray::fromRawData(view, static_cast<int>(rawSize));
         } else {
             record.m_rawData.resize(static_cast<int>(rawSize));
             stream.readRawData(record.m_rawData.data(), record.m_rawData.length());
@@ -754,13 +1227,23 @@ QDataStream &operator>>(QDataStream &stream, PerfRecordSample &record)
             stream.skipRawData(static_cast<int>(sectionSize));
             stream.skipRawData(sizeof(quint64)); // skip contentSize
         } else if (sectionSize > 0) {
-            record.m_userStack.resize(static_cast<int>(sectionSize));
-            stream.readRawData(record.m_userStack.data(), record.m_userStack.size());
+            const char *view = mapped ? mapped->readView(static_cast<int>(sectionSize)) : nullptr;
+            if (!view) {
+                record.m_userStack.resize(static_cast<int>(sectionSize));
+                stream.readRawData(record.m_userStack.data(), record.m_userStack.size());
+            }
 
             quint64 contentSize;
             stream >> contentSize;
-            if (contentSize > sectionSize)
+            if (contentSize > sectionSize) {
                 qWarning() << "Truncated stack snapshot" << contentSize << sectionSize;
+                contentSize = sectionSize;
+            }
+
+            // Resizing would detach a view, so create it with the right size right away.
+            record.m_userStackIsMapped = (view != nullptr);
+            if (view)
+                record.m_userStack = QByteArray::fromRawData(view, static_cast<int>(contentSize));
             else
                 record.m_userStack.resize(static_cast<int>(contentSize));
         }
@@ -22,11 +22,17 @@
 
 #include "perfattributes.h"
 #include "perffeatures.h"
+#include "perfflathash.h"
 #include "perfheader.h"
+#include "perftimeindex.h"
 
 #include <config-perfparser.h> // generated by cmake
 
+#include <QBuffer>
 #include <QIODevice>
+#include <QSet>
+
+#include <limits>
 
 #if HAVE_ZSTD
 #include <zstd.h>
@@ -495,6 +501,11 @@ public:
                      const PerfEventAttributes *attributes = nullptr);
     quint64 registerAbi() const { return m_registerAbi; }
     quint64 registerValue(int reg) const;
+    bool hasRegister(int reg) const
+    {
+        return m_registerAbi && reg >= 0 && reg < 64 && (m_registerMask & (1ull << reg));
+    }
+    const QList<quint64> &registers() const { return m_registers; }
     quint64 ip() const { return m_ip; }
     const QByteArray &userStack() const { return m_userStack; }
     const QList<quint64> &callchain() const { return m_callchain; }
@@ -527,6 +538,16 @@ public:
     };
     const QList<BranchEntry> &branchStack() const { return m_branchStack; }
 
+    // Whether the user stack was copied out of the input, rather than referring to a mapped file
+    bool ownsUserStack() const { return !m_userStackIsMapped && !m_userStack.isEmpty(); }
+
+    // While buffered, the user stack can be moved out to a spill file. See PerfUnwind.
+    bool isUserStackSpilled() const { return m_spilledUserStackOffset >= 0; }
+    qint64 spilledUserStackOffset() const { return m_spilledUserStackOffset; }
+    int spilledUserStackSize() const { return m_spilledUserStackSize; }
+    void setUserStackSpilled(qint64 offset);
+    void restoreUserStack(const QByteArray &userStack);
+
 private:
 
     quint64 m_readFormat;
@@ -549,6 +570,9 @@ private:
     QList<BranchEntry> m_branchStack;
     QList<quint64> m_registers;
     QByteArray m_userStack;
+    bool m_userStackIsMapped = false;
+    qint64 m_spilledUserStackOffset = -1;
+    int m_spilledUserStackSize = 0;
 
     friend QDataStream &operator>>(QDataStream &stream, PerfRecordSample &record);
 };
@@ -625,7 +649,51 @@ private:
 
 QDataStream &operator>>(QDataStream &stream, PerfRecordContextSwitchCpuWide &record);
 
+// Read-only buffer on a memory mapped part of a perf.data file. The mapping stays valid for as
+// long as the file is open, so records parsed from it can refer to the mapped memory for their
+// bulk data, rather than copying it.
+class PerfMappedBuffer : public QBuffer
+{
+    Q_OBJECT
+public:
+    PerfMappedBuffer(const uchar *data, int size, QObject *parent = nullptr);
+
+    // Returns the data at the current position without copying it, or nullptr if less than
+    // length bytes are left. The position is advanced past the data.
+    const char *readView(int length);
+};
+
+// Limits the samples that are analyzed. Samples are only dropped by the fields they carry, e.g. a
+// time range doesn't apply to samples recorded without PERF_SAMPLE_TIME.
+struct PerfSampleFilter
+{
+    bool isEmpty() const
+    {
+        return timeFrom == 0 && timeTo == std::numeric_limits<quint64>::max()
+                && pids.isEmpty() && tids.isEmpty() && cpus.isEmpty() && sampleRate == 1
+                && maxSamples == std::numeric_limits<quint64>::max();
+    }
+
+    // inclusive, in the perf clock's nanoseconds
+    quint64 timeFrom = 0;
+    quint64 timeTo = std::numeric_limits<quint64>::max();
+    // empty sets accept all values
+    QSet<quint32> pids;
+    QSet<quint32> tids;
+    QSet<quint32> cpus;
+
+    // Of the samples that pass the filters above, only keep every sampleRate-th of each thread
+    // and event, starting with the first one. The periods of the kept samples are scaled up
+    // accordingly, see PerfUnwind::setPeriodScale().
+    quint32 sampleRate = 1;
+    // Keep at most maxSamples samples. With a time index, the sample rate is raised so that
+    // roughly this many samples are spread over the whole window. Otherwise this is a plain
+    // truncation: the samples after the first maxSamples are dropped and nothing is rescaled.
+    quint64 maxSamples = std::numeric_limits<quint64>::max();
+};
+
 class PerfUnwind;
+class PerfDecompressAhead;
 class PerfData : public QObject
 {
     Q_OBJECT
@@ -636,6 +704,22 @@ public:
 
     bool setCompressed(const PerfCompressed &compressed);
 
+    // Decompress the compressed records of mapped perf.data files on a separate thread, ahead of
+    // the parser.
+    void setDecompressAhead(bool decompressAhead) { m_decompressAheadEnabled = decompressAhead; }
+
+    // Samples rejected by @p filter are skipped right after their fixed size header is read,
+    // before they are buffered or unwound. All other events are still processed, as they are
+    // needed to keep track of the processes and their mappings. This also sets the period scale
+    // of the destination to the sample rate.
+    void setSampleFilter(const PerfSampleFilter &filter);
+
+    // Use the time index in @p fileName to only read the parts of a perf.data file's data section
+    // that are needed for the time window of the sample filter. If the file doesn't exist or
+    // belongs to a different data section, the whole data section is read and the index is
+    // written to @p fileName afterwards. Data in pipe mode can't be indexed.
+    void setTimeIndexFile(const QString &fileName) { m_timeIndexFile = fileName; }
+
 public slots:
     void read();
     void finishReading();
@@ -666,7 +750,68 @@ private:
 #if HAVE_ZSTD
     ZSTD_DStream *m_zstdDstream = nullptr;
 #endif
+    bool m_decompressAheadEnabled = false;
+    // only set while parsing a mapped data section
+    PerfDecompressAhead *m_decompressAhead = nullptr;
+    PerfSampleFilter m_sampleFilter;
+    QString m_timeIndexFile;
+    PerfTimeIndex m_timeIndex;
+    bool m_buildTimeIndex = false;
+    // set by a FINISHED_ROUND record while building the time index
+    bool m_roundFinished = false;
+    // set while reading the parts of the data section that are only needed for their state
+    bool m_skipSamples = false;
+
+    // Samples are decimated per thread and event, so that the events of a thread that are
+    // sampled in turns are all kept at the same rate.
+    struct DecimationKey
+    {
+        quint32 tid = 0;
+        quint32 type = 0;
+        quint64 config = 0;
+
+        bool operator==(const DecimationKey &other) const
+        {
+            return tid == other.tid && type == other.type && config == other.config;
+        }
+
+        friend uint qHash(const DecimationKey &key, uint seed = 0)
+        {
+            QtPrivate::QHashCombine hash;
+            seed = hash(seed, key.tid);
+            seed = hash(seed, key.type);
+            return hash(seed, key.config);
+        }
+    };
+
+    // the sample rate of the filter, or the one derived from maxSamples and the time index
+    quint32 m_sampleRate = 1;
+    // number of samples that passed the filter, per thread and event, and number of samples kept
+    PerfFlatHash<DecimationKey, quint64> m_numFilteredSamples;
+    quint64 m_numKeptSamples = 0;
+
+    // The fields at the start of a sample, see PERF_RECORD_SAMPLE. An event without a thread
+    // ID is decimated as thread 0.
+    struct SampleFields
+    {
+        bool isValid = false;
+        quint64 sampleType = 0;
+        quint32 eventType = 0;
+        quint64 eventConfig = 0;
+        quint32 pid = 0;
+        quint32 tid = 0;
+        quint64 time = 0;
+        quint32 cpu = 0;
+    };
 
     ReadStatus processEvents(QDataStream &stream);
+    SampleFields peekSample(QDataStream &stream, quint16 contentSize, int idOffset) const;
+    bool acceptSample(const SampleFields &fields);
     ReadStatus doRead();
+    QString sourceFileName() const;
+    QVector<PerfTimeIndex::Range> timeIndexRanges();
+    const uchar *mapDataSection() const;
+    ReadStatus doReadMapped(const uchar *data, qint64 size,
+                            const QVector<PerfTimeIndex::Range> &ranges);
+    ReadStatus doReadSeekable(const QVector<PerfTimeIndex::Range> &ranges);
 };
@@ -302,6 +302,53 @@ DwarfSourceLocation findSourceLocation(Dwarf_Die* cuDie, Dwarf_Addr offset)
     return ret;
 }
 
+void DwarfRangeIndex::add(DwarfRange range, int index)
+{
+    if (range.low < range.high)
+        m_entries.append({range, index});
+}
+
+void DwarfRangeIndex::finalize()
+{
+    std::sort(m_entries.begin(), m_entries.end(), [](const Entry &lhs, const Entry &rhs) {
+        return lhs.range.low < rhs.range.low;
+    });
+
+    m_maxHigh.resize(m_entries.size());
+    Dwarf_Addr maxHigh = 0;
+    for (int i = 0, c = m_entries.size(); i < c; ++i) {
+        maxHigh = std::max(maxHigh, m_entries[i].range.high);
+        m_maxHigh[i] = maxHigh;
+    }
+}
+
+void DwarfRangeIndex::clear()
+{
+    m_entries.clear();
+    m_maxHigh.clear();
+}
+
+int DwarfRangeIndex::find(Dwarf_Addr addr) const
+{
+    Q_ASSERT(m_entries.size() == m_maxHigh.size());
+
+    // all entries starting after addr can be skipped right away
+    auto it = std::upper_bound(m_entries.cbegin(), m_entries.cend(), addr, [](Dwarf_Addr addr, const Entry &entry) {
+        return addr < entry.range.low;
+    });
+
+    // walk backwards for as long as an earlier range may still reach addr
+    // ranges usually don't overlap, so this commonly only checks a single entry,
+    // but we still have to look at all overlapping ones to find the lowest index
+    int index = -1;
+    for (auto i = std::distance(m_entries.cbegin(), it) - 1; i >= 0 && m_maxHigh[i] > addr; --i) {
+        const auto &entry = m_entries[i];
+        if (entry.range.contains(addr) && (index == -1 || entry.index < index))
+            index = entry.index;
+    }
+    return index;
+}
+
 SubProgramDie::SubProgramDie(Dwarf_Die die)
     : m_ranges{die, {}}
 {
@@ -313,31 +360,45 @@ SubProgramDie::SubProgramDie(Dwarf_Die die)
 
 SubProgramDie::~SubProgramDie() = default;
 
-CuDieRangeMapping::CuDieRangeMapping(Dwarf_Die cudie, Dwarf_Addr bias)
+CuDieRangeMapping::CuDieRangeMapping(Dwarf_Die cudie, Dwarf_Addr bias, Dwarf *dwarf,
+                                     ModuleDieRanges::CuRanges *shared)
     : m_bias{bias}
+    , m_dwarf{dwarf}
     , m_cuDieRanges{cudie, {}}
+    , m_shared{shared}
 {
-    walkRanges([this, bias](DwarfRange range) {
+    m_cuDieRanges.ranges.reserve(shared->ranges.size());
+    for (const auto &range : shared->ranges)
         m_cuDieRanges.ranges.append({range.low + bias, range.high + bias});
-        return true;
-    }, &cudie);
 }
 
 CuDieRangeMapping::~CuDieRangeMapping() = default;
 
 SubProgramDie *CuDieRangeMapping::findSubprogramDie(Dwarf_Addr offset)
 {
-    if (m_subPrograms.isEmpty())
+    if (!m_shared)
+        return nullptr;
+
+    if (!m_shared->hasSubprograms)
         addSubprograms();
+    else if (m_subPrograms.isEmpty())
+        m_subPrograms.resize(m_shared->subprogramOffsets.size());
 
-    auto it = std::find_if(m_subPrograms.begin(), m_subPrograms.end(),
-                        [offset](const SubProgramDie &program) {
-                                return program.contains(offset);
-                        });
-    if (it == m_subPrograms.end())
+    const auto index = m_shared->subprogramIndex.find(offset);
+    if (index == -1)
         return nullptr;
 
-    return &(*it);
+    auto &program = m_subPrograms[index];
+    if (program.isEmpty()) {
+        // the ranges were found by another process, we only need to look up the DIE itself
+        Dwarf_Die die;
+        if (!dwarf_offdie(m_dwarf, m_shared->subprogramOffsets[index], &die))
+            return nullptr;
+        program = SubProgramDie(die);
+        if (program.isEmpty())
+            return nullptr;
+    }
+    return &program;
 }
 
 void CuDieRangeMapping::addSubprograms()
@@ -348,13 +409,19 @@ void CuDieRangeMapping::addSubprograms()
 
         if (dwarf_tag(die) == DW_TAG_subprogram) {
             SubProgramDie program(*die);
-            if (!program.isEmpty())
+            if (!program.isEmpty()) {
+                for (const auto &range : program.ranges())
+                    m_shared->subprogramIndex.add(range, m_subPrograms.size());
+                m_shared->subprogramOffsets.append(dwarf_dieoffset(die));
                 m_subPrograms.append(program);
+            }
 
             return WalkResult::Skip;
         }
         return WalkResult::Recurse;
     }, cudie());
+    m_shared->subprogramIndex.finalize();
+    m_shared->hasSubprograms = true;
 }
 
 QByteArray CuDieRangeMapping::dieName(Dwarf_Die *die)
@@ -366,30 +433,57 @@ QByteArray CuDieRangeMapping::dieName(Dwarf_Die *die)
     return name;
 }
 
-PerfDwarfDieCache::PerfDwarfDieCache(Dwfl_Module *mod)
+PerfDwarfDieCache::PerfDwarfDieCache(Dwfl_Module *mod, QSharedPointer<ModuleDieRanges> ranges)
+    : m_ranges(ranges ? std::move(ranges) : QSharedPointer<ModuleDieRanges>::create())
 {
     if (!mod)
         return;
 
-    Dwarf_Die *die = nullptr;
-    Dwarf_Addr bias = 0;
-    while ((die = dwfl_module_nextcu(mod, die, &bias))) {
-        CuDieRangeMapping cuDieMapping(*die, bias);
-        if (!cuDieMapping.isEmpty())
-            m_cuDieRanges.push_back(cuDieMapping);
+    m_dwarf = dwfl_module_getdwarf(mod, &m_bias);
+    if (!m_dwarf)
+        return;
+
+    if (!m_ranges->hasCus) {
+        Dwarf_Die *die = nullptr;
+        Dwarf_Addr bias = 0;
+        while ((die = dwfl_module_nextcu(mod, die, &bias))) {
+            ModuleDieRanges::CuRanges cu;
+            cu.dieOffset = dwarf_dieoffset(die);
+            walkRanges([&cu](DwarfRange range) {
+                cu.ranges.append(range);
+                return true;
+            }, die);
+            if (!cu.ranges.isEmpty()) {
+                for (const auto &range : cu.ranges)
+                    m_ranges->cuIndex.add(range, m_ranges->cus.size());
+                m_ranges->cus.append(cu);
+            }
+        }
+        m_ranges->cuIndex.finalize();
+        m_ranges->hasCus = true;
     }
+
+    m_cuDieRanges.resize(m_ranges->cus.size());
 }
 
 PerfDwarfDieCache::~PerfDwarfDieCache() = default;
 
 CuDieRangeMapping *PerfDwarfDieCache::findCuDie(Dwarf_Addr addr)
 {
-    auto it = std::find_if(m_cuDieRanges.begin(), m_cuDieRanges.end(),
-                            [addr](const CuDieRangeMapping &cuDieMapping) {
-                                return cuDieMapping.contains(addr);
-                            });
-    if (it == m_cuDieRanges.end())
+    if (!m_dwarf || addr < m_bias)
         return nullptr;
 
-    return &(*it);
+    const auto index = m_ranges->cuIndex.find(addr - m_bias);
+    if (index == -1)
+        return nullptr;
+
+    auto &mapping = m_cuDieRanges[index];
+    if (mapping.isEmpty()) {
+        auto &cu = m_ranges->cus[index];
+        Dwarf_Die die;
+        if (!dwarf_offdie(m_dwarf, cu.dieOffset, &die))
+            return nullptr;
+        mapping = CuDieRangeMapping(die, m_bias, m_dwarf, &cu);
+    }
+    return &mapping;
 }
@@ -23,6 +23,7 @@
 
 #include <QVector>
 #include <QHash>
+#include <QSharedPointer>
 
 #include <algorithm>
 
@@ -40,6 +41,57 @@ struct DwarfRange
     }
 };
 
+/**
+ * Flattened table of dwarf ranges, sorted by their start address, that maps an address back to
+ * the index of the entry it belongs to in logarithmic time.
+ */
+class DwarfRangeIndex
+{
+public:
+    /// add @p range for the entry with the given @p index
+    void add(DwarfRange range, int index);
+    /// sort the table, must be called after the last @c add and before any @c find
+    void finalize();
+    void clear();
+    bool isEmpty() const { return m_entries.isEmpty(); }
+
+    /// @return the lowest index of all entries with a range that contains @p addr, or -1
+    int find(Dwarf_Addr addr) const;
+
+private:
+    struct Entry
+    {
+        DwarfRange range;
+        int index;
+    };
+    QVector<Entry> m_entries;
+    // maximum of all range.high values up to and including the entry at the same position
+    QVector<Dwarf_Addr> m_maxHigh;
+};
+
+/**
+ * Bias-corrected ranges of the CUs and subprograms of a module, with the offsets of their DIEs.
+ * These only depend on the file, so all processes that load the same file can share them, and
+ * each only needs to look up the DIEs it actually uses.
+ */
+struct ModuleDieRanges
+{
+    struct CuRanges
+    {
+        Dwarf_Off dieOffset = 0;
+        QVector<DwarfRange> ranges;
+
+        /// filled on first use, see @c CuDieRangeMapping::findSubprogramDie
+        bool hasSubprograms = false;
+        QVector<Dwarf_Off> subprogramOffsets;
+        DwarfRangeIndex subprogramIndex;
+    };
+
+    bool hasCus = false;
+    QVector<CuRanges> cus;
+    DwarfRangeIndex cuIndex;
+};
+
 /// cache of dwarf ranges for a given Dwarf_Die
 struct DieRanges
 {
@@ -65,6 +117,7 @@ public:
     bool isEmpty() const { return m_ranges.ranges.isEmpty(); }
     /// @p offset a bias-corrected offset
     bool contains(Dwarf_Addr offset) const { return m_ranges.contains(offset); }
+    const QVector<DwarfRange> &ranges() const { return m_ranges.ranges; }
     Dwarf_Die *die() { return &m_ranges.die; }
 
 private:
@@ -76,11 +129,14 @@ class CuDieRangeMapping
 {
 public:
     CuDieRangeMapping() = default;
-    CuDieRangeMapping(Dwarf_Die cudie, Dwarf_Addr bias);
+    /// @p shared the ranges of @p cudie, which may be shared with other modules loaded from the same file
+    CuDieRangeMapping(Dwarf_Die cudie, Dwarf_Addr bias, Dwarf *dwarf, ModuleDieRanges::CuRanges *shared);
     ~CuDieRangeMapping();
 
     bool isEmpty() const { return m_cuDieRanges.ranges.isEmpty(); }
     bool contains(Dwarf_Addr addr) const { return m_cuDieRanges.contains(addr); }
+    /// @return the absolute, bias-corrected address ranges of this CU
+    const QVector<DwarfRange> &ranges() const { return m_cuDieRanges.ranges; }
     Dwarf_Addr bias() { return m_bias; }
     Dwarf_Die *cudie() { return &m_cuDieRanges.die; }
 
@@ -96,7 +152,10 @@ private:
     void addSubprograms();
 
     Dwarf_Addr m_bias = 0;
+    Dwarf *m_dwarf = nullptr;
     DieRanges m_cuDieRanges;
+    ModuleDieRanges::CuRanges *m_shared = nullptr;
+    /// only filled for the subprograms that were looked up
     QVector<SubProgramDie> m_subPrograms;
     QHash<Dwarf_Off, QByteArray> m_dieNameCache;
 };
@@ -142,14 +201,23 @@ DwarfSourceLocation findSourceLocation(Dwarf_Die* cuDie, Dwarf_Addr offset);
 class PerfDwarfDieCache
 {
 public:
-    PerfDwarfDieCache(Dwfl_Module *mod = nullptr);
+    /// @p ranges the ranges of @p mod to fill or use. If they were filled for another module
+    /// loaded from the same file already, they are not read again.
+    PerfDwarfDieCache(Dwfl_Module *mod = nullptr,
+                      QSharedPointer<ModuleDieRanges> ranges = QSharedPointer<ModuleDieRanges>());
     ~PerfDwarfDieCache();
 
     /// @p addr absolute address, not bias-corrected
     CuDieRangeMapping *findCuDie(Dwarf_Addr addr);
 
 public:
+    /// only filled for the CUs that were looked up
     QVector<CuDieRangeMapping> m_cuDieRanges;
+
+private:
+    Dwarf *m_dwarf = nullptr;
+    Dwarf_Addr m_bias = 0;
+    QSharedPointer<ModuleDieRanges> m_ranges;
 };
 QT_BEGIN_NAMESPACE
 Q_DECLARE_TYPEINFO(DwarfRange, Q_MOVABLE_TYPE);
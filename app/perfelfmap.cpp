@@ -26,10 +26,10 @@
 QDebug operator<<(QDebug stream, const PerfElfMap::ElfInfo& info)
 {
     stream.nospace() << "ElfInfo{"
-                     << "localFile=" << info.localFile.absoluteFilePath() << ", "
+                     << "localFile=" << info.localFilePath() << ", "
                      << "isFile=" << info.isFile() << ", "
-                     << "originalFileName=" << info.originalFileName << ", "
-                     << "originalPath=" << info.originalPath << ", "
+                     << "originalFileName=" << info.originalFileName() << ", "
+                     << "originalPath=" << info.originalPath() << ", "
                      << "addr=" << Qt::hex << info.addr << ", "
                      << "len=" << Qt::hex << info.length << ", "
                      << "pgoff=" << Qt::hex << info.pgoff << ", "
@@ -45,6 +45,20 @@ QDebug operator<<(QDebug stream, const PerfElfMap::ElfInfo& info)
 }
 
 namespace {
+// The remaining part of @p elf, with the same files but not yet reported to dwfl
+PerfElfMap::ElfInfo fragment(const PerfElfMap::ElfInfo &elf, quint64 addr, quint64 length,
+                             quint64 pgoff)
+{
+    PerfElfMap::ElfInfo result = elf;
+    result.addr = addr;
+    result.length = length;
+    result.pgoff = pgoff;
+    result.baseAddr = PerfElfMap::ElfInfo::INVALID_BASE_ADDR;
+    result.dwflStart = 0;
+    result.dwflEnd = 0;
+    return result;
+}
+
 struct SortByAddr
 {
     bool operator()(const PerfElfMap::ElfInfo &lhs, const quint64 addr) const
@@ -59,8 +73,9 @@ struct SortByAddr
 };
 }
 
-PerfElfMap::PerfElfMap(QObject *parent)
+PerfElfMap::PerfElfMap(PerfStringTable *paths, QObject *parent)
     : QObject(parent)
+    , m_paths(paths)
 {
 }
 
@@ -71,15 +86,18 @@ void PerfElfMap::registerElf(quint64 addr, quint64 len, quint64 pgoff,
                              const QByteArray &originalPath)
 {
     quint64 addrEnd = addr + len;
+    const qint32 originalPathId = m_paths->insert(originalPath);
 
+    // Only look at the elfs through const iterators here, so that a map shared with the parent
+    // process isn't detached if the mapping is known already.
     QVarLengthArray<ElfInfo, 8> newElfs;
     QVarLengthArray<int, 8> removedElfs;
-    for (auto i = m_elfs.begin(), end = m_elfs.end(); i != end && i->addr < addrEnd; ++i) {
+    for (auto i = m_elfs.cbegin(), end = m_elfs.cend(); i != end && i->addr < addrEnd; ++i) {
         const quint64 iEnd = i->addr + i->length;
         if (iEnd < addr)
             continue;
 
-        if (addr - pgoff == i->addr - i->pgoff && originalPath == i->originalPath) {
+        if (addr - pgoff == i->addr - i->pgoff && originalPathId == i->originalPathId) {
             // Remapping parts of the same file in the same place: Extend to maximum continuous
             // address range and check if we already have that.
             addr = qMin(addr, i->addr);
@@ -101,28 +119,23 @@ void PerfElfMap::registerElf(quint64 addr, quint64 len, quint64 pgoff,
         // Newly added elf overwrites existing one. Mark the existing one as overwritten and
         // reinsert any fragments of it that remain.
 
-        if (i->addr < addr) {
-            newElfs.push_back(ElfInfo(i->localFile, i->addr, addr - i->addr, i->pgoff,
-                                      i->originalFileName, i->originalPath));
-        }
-        if (iEnd > addrEnd) {
-            newElfs.push_back(ElfInfo(i->localFile, addrEnd, iEnd - addrEnd,
-                                      i->pgoff + addrEnd - i->addr,
-                                      i->originalFileName, i->originalPath));
-        }
+        if (i->addr < addr)
+            newElfs.push_back(fragment(*i, i->addr, addr - i->addr, i->pgoff));
+        if (iEnd > addrEnd)
+            newElfs.push_back(fragment(*i, addrEnd, iEnd - addrEnd, i->pgoff + addrEnd - i->addr));
 
         emit aboutToInvalidate(*i);
-        removedElfs.push_back(static_cast<int>(std::distance(m_elfs.begin(), i)));
+        removedElfs.push_back(static_cast<int>(std::distance(m_elfs.cbegin(), i)));
     }
 
     // remove the overwritten elfs, iterate from the back to not invalidate the indices
     for (auto it = removedElfs.rbegin(), end = removedElfs.rend(); it != end; ++it)
         m_elfs.remove(*it);
 
-    ElfInfo elf(fullPath, addr, len, pgoff, originalFileName, originalPath);
+    ElfInfo elf(m_paths, fullPath, addr, len, pgoff, originalFileName, originalPath);
 
     if (elf.isFile()) {
-        if (m_lastBase.originalPath == originalPath && elf.addr > m_lastBase.addr)
+        if (m_lastBase.originalPathId == originalPathId && elf.addr > m_lastBase.addr)
             elf.baseAddr = m_lastBase.addr;
         else if (!pgoff)
             m_lastBase = elf;
@@ -156,12 +169,18 @@ PerfElfMap::ElfInfo PerfElfMap::findElf(quint64 ip) const
 
 void PerfElfMap::updateElf(quint64 addr, quint64 dwflStart, quint64 dwflEnd)
 {
-    auto i = std::upper_bound(m_elfs.begin(), m_elfs.end(), addr, SortByAddr());
-    Q_ASSERT(i != m_elfs.begin());
+    auto i = std::upper_bound(m_elfs.cbegin(), m_elfs.cend(), addr, SortByAddr());
+    Q_ASSERT(i != m_elfs.cbegin());
     --i;
     Q_ASSERT(i->addr == addr);
-    i->dwflStart = dwflStart;
-    i->dwflEnd = dwflEnd;
+
+    // Forked processes report the same modules at the same places as their parents. Don't detach.
+    if (i->dwflStart == dwflStart && i->dwflEnd == dwflEnd)
+        return;
+
+    ElfInfo &elf = m_elfs[static_cast<int>(std::distance(m_elfs.cbegin(), i))];
+    elf.dwflStart = dwflStart;
+    elf.dwflEnd = dwflEnd;
 }
 
 bool PerfElfMap::isAddressInRange(quint64 addr) const
@@ -20,6 +20,9 @@
 
 #pragma once
 
+#include "perfstringtable.h"
+
+#include <QFile>
 #include <QFileInfo>
 #include <QVector>
 #include <limits>
@@ -28,22 +31,27 @@ class PerfElfMap : public QObject
 {
     Q_OBJECT
 public:
+    // A mapping of an ELF file. The paths are interned in a PerfStringTable shared by all maps, so
+    // that ElfInfo can cheaply be copied around when looking up addresses.
     struct ElfInfo {
         enum {
             INVALID_BASE_ADDR = std::numeric_limits<quint64>::max()
         };
-        explicit ElfInfo(const QFileInfo &localFile = QFileInfo(), quint64 addr = 0,
+        ElfInfo() = default;
+        explicit ElfInfo(PerfStringTable *paths, const QFileInfo &localFile, quint64 addr = 0,
                          quint64 length = 0, quint64 pgoff = 0,
                          const QByteArray &originalFileName = {},
                          const QByteArray &originalPath = {}) :
-            localFile(localFile),
-            originalFileName(originalFileName.isEmpty()
+            addr(addr), length(length), pgoff(pgoff),
+            localFileId(paths->insert(QFile::encodeName(localFile.absoluteFilePath()))),
+            originalFileNameId(paths->insert(originalFileName.isEmpty()
                 ? localFile.fileName().toLocal8Bit()
-                : originalFileName),
-            originalPath(originalPath.isEmpty()
+                : originalFileName)),
+            originalPathId(paths->insert(originalPath.isEmpty()
                 ? localFile.absoluteFilePath().toLocal8Bit()
-                : originalPath),
-            addr(addr), length(length), pgoff(pgoff)
+                : originalPath)),
+            isLocalFile(localFile.isFile()),
+            paths(paths)
         {}
 
         bool isValid() const
@@ -53,7 +61,7 @@ public:
 
         bool isFile() const
         {
-            return localFile.isFile();
+            return isLocalFile;
         }
 
         bool hasBaseAddr() const
@@ -61,12 +69,33 @@ public:
             return baseAddr != INVALID_BASE_ADDR;
         }
 
+        // absolute path of the local file, encoded for the file system
+        QByteArray localFilePath() const
+        {
+            return path(localFileId);
+        }
+
+        QFileInfo localFile() const
+        {
+            return QFileInfo(QFile::decodeName(localFilePath()));
+        }
+
+        QByteArray originalFileName() const
+        {
+            return path(originalFileNameId);
+        }
+
+        QByteArray originalPath() const
+        {
+            return path(originalPathId);
+        }
+
         bool operator==(const ElfInfo& rhs) const
         {
             return isFile() == rhs.isFile()
-                && (!isFile() || localFile == rhs.localFile)
-                && originalFileName == rhs.originalFileName
-                && originalPath == rhs.originalPath
+                && (!isFile() || localFileId == rhs.localFileId)
+                && originalFileNameId == rhs.originalFileNameId
+                && originalPathId == rhs.originalPathId
                 && addr == rhs.addr
                 && length == rhs.length
                 && pgoff == rhs.pgoff
@@ -78,18 +107,29 @@ public:
             return !operator==(rhs);
         }
 
-        QFileInfo localFile;
-        QByteArray originalFileName;
-        QByteArray originalPath;
-        quint64 addr;
-        quint64 length;
-        quint64 pgoff;
+        quint64 addr = 0;
+        quint64 length = 0;
+        quint64 pgoff = 0;
         quint64 baseAddr = INVALID_BASE_ADDR;
         quint64 dwflStart = 0;
         quint64 dwflEnd = 0;
+        // IDs in paths, -1 if not set
+        qint32 localFileId = -1;
+        qint32 originalFileNameId = -1;
+        qint32 originalPathId = -1;
+        bool isLocalFile = false;
+        const PerfStringTable *paths = nullptr;
+
+    private:
+        QByteArray path(qint32 id) const
+        {
+            return paths ? paths->string(id) : QByteArray();
+        }
     };
 
-    explicit PerfElfMap(QObject *parent = nullptr);
+    // The paths of the elfs are interned in @p paths, which has to outlive the map. It can be
+    // shared between maps, so that the same path has the same ID in all of them.
+    explicit PerfElfMap(PerfStringTable *paths, QObject *parent = nullptr);
     ~PerfElfMap();
 
     void registerElf(quint64 addr, quint64 len, quint64 pgoff,
@@ -106,8 +146,11 @@ public:
 
     bool isAddressInRange(quint64 addr) const;
 
+    // The elfs are implicitly shared with @p parent until either map registers a new elf. Both
+    // maps need to intern their paths in the same table.
     void copyDataFrom(const PerfElfMap *parent)
     {
+        Q_ASSERT(m_paths == parent->m_paths);
         m_elfs = parent->m_elfs;
         m_lastBase = parent->m_lastBase;
     }
@@ -116,6 +159,7 @@ signals:
     void aboutToInvalidate(const PerfElfMap::ElfInfo &elf);
 
 private:
+    PerfStringTable *m_paths;
     // elf sorted by start address
     QVector<ElfInfo> m_elfs;
     // last registered elf with zero pgoff
@@ -0,0 +1,90 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#pragma once
+
+#include <QList>
+
+#include <algorithm>
+
+// Events waiting to be processed in time order. Events are appended as they arrive and the ones
+// that arrive out of order are only sorted in by sort(). Inserting each of them right away would
+// move all later events every time: without a CPU field in the samples, the events of all CPUs
+// share a buffer, and perf writes the events of one CPU after the other within each round.
+template<typename Event>
+class PerfEventBuffer
+{
+public:
+    using Iterator = typename QList<Event>::Iterator;
+
+    void append(const Event &event)
+    {
+        if (m_numSorted == m_events.size()
+                && (m_events.isEmpty() || m_events.last().time() <= event.time())) {
+            ++m_numSorted;
+        }
+        m_events.append(event);
+    }
+
+    // Sort the events by time. Events with the same time keep the order they arrived in, which
+    // is important esp. when we runtime-attach, as we will then get lots of mmap events with
+    // time 0. Only the events appended out of order since the last call are sorted, and then
+    // merged with the others.
+    void sort()
+    {
+        if (m_numSorted == m_events.size())
+            return;
+
+        const auto byTime = [](const Event &lhs, const Event &rhs) {
+            return lhs.time() < rhs.time();
+        };
+        const auto middle = m_events.begin() + m_numSorted;
+        std::stable_sort(middle, m_events.end(), byTime);
+        std::inplace_merge(m_events.begin(), middle, m_events.end(), byTime);
+        m_numSorted = m_events.size();
+    }
+
+    bool isSorted() const { return m_numSorted == m_events.size(); }
+
+    // Remove the events before @p end, which have to be sorted already.
+    void removeUntil(Iterator end)
+    {
+        const auto count = static_cast<int>(std::distance(m_events.begin(), end));
+        Q_ASSERT(count <= m_numSorted);
+        m_events.erase(m_events.begin(), end);
+        m_numSorted -= count;
+    }
+
+    bool isEmpty() const { return m_events.isEmpty(); }
+    int size() const { return m_events.size(); }
+    const Event &first() const { return m_events.first(); }
+    const Event &at(int i) const { return m_events.at(i); }
+    Event &operator[](int i) { return m_events[i]; }
+
+    Iterator begin() { return m_events.begin(); }
+    Iterator end() { return m_events.end(); }
+    typename QList<Event>::ConstIterator begin() const { return m_events.begin(); }
+    typename QList<Event>::ConstIterator end() const { return m_events.end(); }
+
+private:
+    QList<Event> m_events;
+    // length of the prefix of m_events that is sorted by time
+    int m_numSorted = 0;
+};
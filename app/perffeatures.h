@@ -62,8 +62,8 @@ struct PerfStringFeature {
 QDataStream &operator>>(QDataStream &stream, PerfStringFeature &stringFeature);
 
 struct PerfNrCpus {
-    quint32 online;
-    quint32 available;
+    quint32 online = 0;
+    quint32 available = 0;
 };
 
 QDataStream &operator>>(QDataStream &stream, PerfNrCpus &nrCpus);
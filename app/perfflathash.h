@@ -0,0 +1,137 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#pragma once
+
+#include <QHash>
+#include <QtAlgorithms>
+#include <QVector>
+
+// Hash table with open addressing and linear probing. Keys and values are stored inline in a
+// single array, so a lookup usually touches only one cache line and doesn't allocate. Entries
+// can't be removed individually, only the whole table can be cleared. Keys need a qHash()
+// overload; its result is scrambled once more, as qHash() of integers is the identity.
+template<typename Key, typename Value>
+class PerfFlatHash
+{
+public:
+    const Value *find(const Key &key) const
+    {
+        if (m_entries.isEmpty())
+            return nullptr;
+
+        const int mask = m_entries.size() - 1;
+        for (int i = bucket(key); ; i = (i + 1) & mask) {
+            const Entry &entry = m_entries.at(i);
+            if (!entry.used)
+                return nullptr;
+            if (entry.key == key)
+                return &entry.value;
+        }
+    }
+
+    Value value(const Key &key, const Value &defaultValue = Value()) const
+    {
+        const Value *found = find(key);
+        return found ? *found : defaultValue;
+    }
+
+    bool contains(const Key &key) const
+    {
+        return find(key) != nullptr;
+    }
+
+    // Inserts a default constructed value if @p key isn't in the table yet.
+    Value &operator[](const Key &key)
+    {
+        // keep the load factor at or below 3/4, so that the probe sequences stay short
+        if ((m_size + 1) * 4 > m_entries.size() * 3)
+            rehash(qMax(int(MinCapacity), m_entries.size() * 2));
+
+        const int mask = m_entries.size() - 1;
+        for (int i = bucket(key); ; i = (i + 1) & mask) {
+            Entry &entry = m_entries[i];
+            if (!entry.used) {
+                entry.key = key;
+                entry.value = Value();
+                entry.used = true;
+                ++m_size;
+                return entry.value;
+            }
+            if (entry.key == key)
+                return entry.value;
+        }
+    }
+
+    void insert(const Key &key, const Value &value)
+    {
+        (*this)[key] = value;
+    }
+
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    int capacity() const { return m_entries.size(); }
+
+    void clear()
+    {
+        m_entries = QVector<Entry>();
+        m_size = 0;
+    }
+
+private:
+    enum {
+        MinCapacity = 16
+    };
+
+    struct Entry
+    {
+        Key key = Key();
+        Value value = Value();
+        bool used = false;
+    };
+
+    int bucket(const Key &key) const
+    {
+        // Multiply with 2^64 / phi and take the highest bits, see PerfStackValues.
+        const quint64 hash = static_cast<quint64>(qHash(key)) * Q_UINT64_C(0x9e3779b97f4a7c15);
+        return static_cast<int>(hash >> (64 - m_bucketBits));
+    }
+
+    void rehash(int capacity)
+    {
+        const QVector<Entry> oldEntries = std::move(m_entries);
+        m_entries = QVector<Entry>(capacity);
+        m_bucketBits = qCountTrailingZeroBits(static_cast<uint>(capacity));
+
+        const int mask = capacity - 1;
+        for (const Entry &oldEntry : oldEntries) {
+            if (!oldEntry.used)
+                continue;
+            int i = bucket(oldEntry.key);
+            while (m_entries.at(i).used)
+                i = (i + 1) & mask;
+            m_entries[i] = oldEntry;
+        }
+    }
+
+    QVector<Entry> m_entries;
+    int m_bucketBits = 0;
+    int m_size = 0;
+};
@@ -80,6 +80,11 @@ const int PerfRegisterInfo::s_perfSp[ARCH_INVALID] = {
     13, 31, 0xffff, 0xffff, 0xffff, 0xffff, 7
 };
 
+// ARM uses r7 or r11 depending on the instruction set, and the layout of the frame records varies
+const int PerfRegisterInfo::s_perfFp[ARCH_INVALID] = {
+    0xffff, 29, 0xffff, 0xffff, 0xffff, 0xffff, 6, 0xffff
+};
+
 const int PerfRegisterInfo::s_dwarfLr[ARCH_INVALID][s_numAbis] = {
     {14, 14},
     {30, 30},
@@ -100,6 +105,29 @@ const int PerfRegisterInfo::s_dwarfIp[ARCH_INVALID][s_numAbis] = {
     {8, 16}
 };
 
+const int PerfRegisterInfo::s_dwarfSp[ARCH_INVALID][s_numAbis] = {
+    {13, 13},
+    {31, 31},
+    {0xffff, 0xffff},
+    {0xffff, 0xffff},
+    {0xffff, 0xffff},
+    {0xffff, 0xffff},
+    {4, 7},
+    {0xffff, 0xffff}
+};
+
+// ARM uses r7 or r11 depending on the instruction set
+const int PerfRegisterInfo::s_dwarfFp[ARCH_INVALID][s_numAbis] = {
+    {0xffff, 0xffff},
+    {29, 29},
+    {0xffff, 0xffff},
+    {0xffff, 0xffff},
+    {0xffff, 0xffff},
+    {0xffff, 0xffff},
+    {5, 6},
+    {0xffff, 0xffff}
+};
+
 const int PerfRegisterInfo::s_dummyRegisters[ARCH_INVALID][2] = {
     {0, 0},
     {72, 80},
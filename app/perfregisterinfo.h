@@ -52,11 +52,18 @@ public:
     static const int s_perfIp[ARCH_INVALID];
     // location of SP register or equivalent in perf register layout for each arch/abi
     static const int s_perfSp[ARCH_INVALID];
+    // location of the frame pointer register in perf register layout for each arch/abi, if the
+    // frame records it points to are laid out as {previous frame pointer, return address}
+    static const int s_perfFp[ARCH_INVALID];
 
     // location of LR register or equivalent in dwarf register layout for each arch/abi
     static const int s_dwarfLr[ARCH_INVALID][s_numAbis];
     // location of IP register or equivalent in dwarf register layout for each arch/abi
     static const int s_dwarfIp[ARCH_INVALID][s_numAbis];
+    // location of SP register or equivalent in dwarf register layout for each arch/abi
+    static const int s_dwarfSp[ARCH_INVALID][s_numAbis];
+    // location of the frame pointer register in dwarf register layout for each arch/abi
+    static const int s_dwarfFp[ARCH_INVALID][s_numAbis];
 
     // ranges of registers expected by libdw, but not provided by perf
     static const int s_dummyRegisters[ARCH_INVALID][2];
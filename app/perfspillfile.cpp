@@ -0,0 +1,73 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perfspillfile.h"
+
+PerfSpillFile::PerfSpillFile(int segmentSize)
+    : m_segmentSize(segmentSize)
+{
+}
+
+qint64 PerfSpillFile::write(const QByteArray &data)
+{
+    if (data.size() > m_segmentSize)
+        return -1;
+    if (!m_file.isOpen() && !m_file.open())
+        return -1;
+
+    if (m_currentSegment == -1 || m_currentSegmentEnd + data.size() > m_segmentSize) {
+        if (m_currentSegment == -1 || m_numArrays.at(m_currentSegment) > 0) {
+            // The current segment is released when its last array is taken, see take().
+            if (m_freeSegments.isEmpty()) {
+                m_currentSegment = m_numArrays.size();
+                m_numArrays.append(0);
+            } else {
+                m_currentSegment = m_freeSegments.takeLast();
+            }
+        }
+        m_currentSegmentEnd = 0;
+    }
+
+    const qint64 offset = static_cast<qint64>(m_currentSegment) * m_segmentSize + m_currentSegmentEnd;
+    if (!m_file.seek(offset) || m_file.write(data) != data.size())
+        return -1;
+
+    ++m_numArrays[m_currentSegment];
+    m_currentSegmentEnd += data.size();
+    return offset;
+}
+
+QByteArray PerfSpillFile::take(qint64 offset, int size)
+{
+    const int segment = static_cast<int>(offset / m_segmentSize);
+    Q_ASSERT(segment < m_numArrays.size() && m_numArrays.at(segment) > 0);
+
+    QByteArray data(size, Qt::Uninitialized);
+    if (!m_file.seek(offset) || m_file.read(data.data(), size) != size)
+        data.clear();
+
+    if (--m_numArrays[segment] == 0) {
+        if (segment == m_currentSegment)
+            m_currentSegmentEnd = 0;
+        else
+            m_freeSegments.append(segment);
+    }
+    return data;
+}
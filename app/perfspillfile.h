@@ -0,0 +1,56 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#pragma once
+
+#include <QByteArray>
+#include <QTemporaryFile>
+#include <QVector>
+
+// Temporary file for data that is only needed again later, roughly in the order it was written.
+// The file is divided into segments of equal size. Once all data written into a segment has been
+// taken back out, the segment is reused, so that the file only grows with the amount of data held
+// at the same time, not with the amount of data written over the whole run.
+class PerfSpillFile
+{
+public:
+    explicit PerfSpillFile(int segmentSize = 1 << 20);
+
+    // Data larger than this can't be written.
+    int segmentSize() const { return m_segmentSize; }
+
+    // @return the offset to take @p data back from, or -1 if it could not be written
+    qint64 write(const QByteArray &data);
+    // Read the @p size bytes written at @p offset and release them. Every offset returned by
+    // write() has to be taken exactly once. Returns an empty array if reading fails.
+    QByteArray take(qint64 offset, int size);
+
+    qint64 size() const { return m_file.size(); }
+    QString errorString() const { return m_file.errorString(); }
+
+private:
+    QTemporaryFile m_file;
+    int m_segmentSize;
+    // number of arrays written into each segment and not taken yet
+    QVector<int> m_numArrays;
+    QVector<int> m_freeSegments;
+    int m_currentSegment = -1;
+    int m_currentSegmentEnd = 0;
+};
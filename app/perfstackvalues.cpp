@@ -0,0 +1,132 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perfstackvalues.h"
+
+#include <QtAlgorithms>
+
+namespace {
+// Stack addresses are aligned and contiguous. Multiply them with 2^64 / phi to spread them over
+// all sets, and take the highest bits as set index.
+int setIndex(quint64 address, int setIndexBits)
+{
+    if (setIndexBits == 0)
+        return 0;
+    return static_cast<int>((address * Q_UINT64_C(0x9e3779b97f4a7c15)) >> (64 - setIndexBits));
+}
+}
+
+PerfStackValues::PerfStackValues(int maxSize)
+{
+    setMaxSize(maxSize);
+}
+
+void PerfStackValues::setMaxSize(int maxSize)
+{
+    m_maxSize = qMax(0, maxSize);
+
+    // The number of sets has to be a power of two, so that we can mask the hash.
+    m_maxCapacity = m_maxSize < SetSize ? 0 : SetSize;
+    while (m_maxCapacity > 0 && m_maxCapacity <= m_maxSize / 2)
+        m_maxCapacity *= 2;
+
+    clear();
+}
+
+void PerfStackValues::clear()
+{
+    m_entries = QVector<Entry>();
+    m_setIndexBits = 0;
+    m_size = 0;
+}
+
+PerfStackValues::Entry *PerfStackValues::findSet(quint64 address)
+{
+    return m_entries.data() + setIndex(address, m_setIndexBits) * SetSize;
+}
+
+const PerfStackValues::Entry *PerfStackValues::findSet(quint64 address) const
+{
+    return m_entries.constData() + setIndex(address, m_setIndexBits) * SetSize;
+}
+
+void PerfStackValues::insert(quint64 address, quint64 value)
+{
+    if (m_maxCapacity == 0)
+        return;
+    if (m_entries.isEmpty())
+        resize(qMin(int(MinCapacity), m_maxCapacity));
+
+    Entry *set = findSet(address);
+    Entry *oldest = set;
+    for (Entry *entry = set, *end = set + SetSize; entry != end; ++entry) {
+        if (entry->age == 0 || entry->address == address) {
+            if (entry->age == 0)
+                ++m_size;
+            *entry = {address, value, ++m_age};
+            return;
+        }
+        if (entry->age < oldest->age)
+            oldest = entry;
+    }
+
+    // The set is full. Rather grow the table than evict anything, as long as we may.
+    if (m_entries.size() < m_maxCapacity) {
+        resize(m_entries.size() * 2);
+        insert(address, value);
+        return;
+    }
+
+    *oldest = {address, value, ++m_age};
+}
+
+bool PerfStackValues::find(quint64 address, quint64 *value) const
+{
+    if (m_entries.isEmpty())
+        return false;
+
+    const Entry *set = findSet(address);
+    for (const Entry *entry = set, *end = set + SetSize; entry != end; ++entry) {
+        if (entry->age != 0 && entry->address == address) {
+            *value = entry->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PerfStackValues::resize(int capacity)
+{
+    const QVector<Entry> oldEntries = std::move(m_entries);
+    m_entries = QVector<Entry>(capacity);
+    m_setIndexBits = qCountTrailingZeroBits(static_cast<uint>(capacity / SetSize));
+
+    // Each old set is split into two new sets, so nothing gets evicted here.
+    for (const Entry &oldEntry : oldEntries) {
+        if (oldEntry.age == 0)
+            continue;
+        for (Entry *entry = findSet(oldEntry.address); ; ++entry) {
+            if (entry->age == 0) {
+                *entry = oldEntry;
+                break;
+            }
+        }
+    }
+}
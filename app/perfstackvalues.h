@@ -0,0 +1,71 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#pragma once
+
+#include <QVector>
+
+// Stack words seen in earlier samples of a process. When the unwinder asks for memory that is
+// neither in the current stack snapshot nor in an ELF file, we can still guess the value from
+// these. The table is set-associative and starts small. It grows up to maxSize() values, after
+// that the oldest value of a set is replaced when a new one is inserted.
+class PerfStackValues
+{
+public:
+    enum {
+        DefaultMaxSize = 1 << 16
+    };
+
+    explicit PerfStackValues(int maxSize = DefaultMaxSize);
+
+    void insert(quint64 address, quint64 value);
+    bool find(quint64 address, quint64 *value) const;
+
+    int size() const { return m_size; }
+    int capacity() const { return m_entries.size(); }
+
+    int maxSize() const { return m_maxSize; }
+    // Also clears the table.
+    void setMaxSize(int maxSize);
+    void clear();
+
+private:
+    enum {
+        SetSize = 4,
+        MinCapacity = 64
+    };
+
+    struct Entry {
+        quint64 address = 0;
+        quint64 value = 0;
+        quint64 age = 0; // 0 for empty entries
+    };
+
+    Entry *findSet(quint64 address);
+    const Entry *findSet(quint64 address) const;
+    void resize(int capacity);
+
+    QVector<Entry> m_entries;
+    int m_setIndexBits = 0;
+    quint64 m_age = 0;
+    int m_size = 0;
+    int m_maxSize = 0;
+    int m_maxCapacity = 0;
+};
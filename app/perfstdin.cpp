@@ -20,12 +20,49 @@
 
 #include "perfstdin.h"
 
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
 #include <QTimer>
+#include <QWaitCondition>
 
+#include <cerrno>
 #include <cstring>
 #include <cstdio>
 #include <limits>
 
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+struct PerfStdin::Reader
+{
+    QMutex mutex;
+    QWaitCondition dataAvailable;
+    QWaitCondition spaceAvailable;
+    QQueue<QByteArray> chunks;
+    qint64 queuedSize = 0;
+    bool atEnd = false;
+    bool stopped = false;
+};
+
+namespace {
+qint64 readStdin(char *data, int maxlen)
+{
+#ifdef Q_OS_WIN
+    return _read(fileno(stdin), data, static_cast<unsigned>(maxlen));
+#else
+    qint64 read = 0;
+    do {
+        read = ::read(fileno(stdin), data, static_cast<size_t>(maxlen));
+    } while (read < 0 && errno == EINTR);
+    return read;
+#endif
+}
+}
+
 PerfStdin::PerfStdin(QObject *parent) : QIODevice(parent)
 {
     connect(&m_timer, &QTimer::timeout, this, &PerfStdin::receiveData);
@@ -44,6 +81,37 @@ bool PerfStdin::open(QIODevice::OpenMode mode)
 
     if (QIODevice::open(mode)) {
         m_buffer.resize(s_minBufferSize);
+
+        m_reader = std::make_shared<Reader>();
+        // the thread only holds on to the shared state, so that it can outlive this device
+        // when it's still blocked in a read while we get closed
+        m_readerThread = QThread::create([reader = m_reader]() {
+            // Read into one buffer and only queue copies of what we got. Shrinking a chunk with
+            // resize() would keep its capacity, and small reads from a pipe would then queue a lot
+            // more memory than queuedSize says.
+            QByteArray buffer(s_maxChunkSize, Qt::Uninitialized);
+            for (;;) {
+                const qint64 read = readStdin(buffer.data(), buffer.size());
+
+                QMutexLocker locker(&reader->mutex);
+                while (!reader->stopped && reader->queuedSize >= s_maxQueuedSize)
+                    reader->spaceAvailable.wait(&reader->mutex);
+                if (reader->stopped)
+                    return;
+
+                if (read > 0) {
+                    reader->chunks.enqueue(QByteArray(buffer.constData(), static_cast<int>(read)));
+                    reader->queuedSize += read;
+                } else {
+                    reader->atEnd = true;
+                }
+                reader->dataAvailable.wakeAll();
+                if (reader->atEnd)
+                    return;
+            }
+        });
+        m_readerThread->start();
+
         m_timer.start();
         return true;
     } else {
@@ -54,6 +122,26 @@ bool PerfStdin::open(QIODevice::OpenMode mode)
 void PerfStdin::close()
 {
     m_timer.stop();
+
+    if (m_readerThread) {
+        {
+            QMutexLocker locker(&m_reader->mutex);
+            m_reader->stopped = true;
+            m_reader->spaceAvailable.wakeAll();
+        }
+
+        // If the reader is blocked on stdin, let it clean up after itself once it returns. Connect
+        // before checking, so that a thread finishing in between is still deleted. Deleting it
+        // right away also drops a deleteLater() that might have been posted already.
+        connect(m_readerThread, &QThread::finished, m_readerThread, &QObject::deleteLater);
+        if (m_readerThread->isFinished()) {
+            m_readerThread->wait();
+            delete m_readerThread;
+        }
+        m_readerThread = nullptr;
+        m_reader.reset();
+    }
+
     QIODevice::close();
 }
 
@@ -71,7 +159,7 @@ qint64 PerfStdin::readData(char *data, qint64 maxlen)
         memcpy(data + read, m_buffer.constData() + m_bufferPos, buffered);
         m_bufferPos += static_cast<int>(buffered);
         read += static_cast<int>(buffered);
-    } while (read < maxlen && fillBuffer(maxlen) > 0);
+    } while (read < maxlen && fillBuffer() > 0);
 
     Q_ASSERT(read > 0 || bufferedAvailable() == 0);
     return (read == 0 && stdinAtEnd()) ? -1 : read;
@@ -86,7 +174,8 @@ qint64 PerfStdin::writeData(const char *data, qint64 len)
 
 void PerfStdin::receiveData()
 {
-    if (fillBuffer() > 0)
+    // don't spin when nothing arrives, but also don't block the event loop for long
+    if (fillBuffer(10) > 0)
         emit readyRead();
     else if (stdinAtEnd())
         close();
@@ -103,34 +192,55 @@ void PerfStdin::resizeBuffer(int newSize)
     m_bufferPos = 0;
 }
 
-qint64 PerfStdin::fillBuffer(qint64 targetBufferSize)
+qint64 PerfStdin::fillBuffer(int timeout)
 {
+    if (!m_reader)
+        return 0;
+
     if (m_bufferUsed == m_bufferPos)
         m_bufferPos = m_bufferUsed = 0;
 
-    targetBufferSize = qMin(targetBufferSize, static_cast<qint64>(s_maxBufferSize));
-    if (targetBufferSize > m_buffer.length())
-        resizeBuffer(static_cast<int>(targetBufferSize));
+    QMutexLocker locker(&m_reader->mutex);
+    if (m_reader->chunks.isEmpty() && !m_reader->atEnd) {
+        if (timeout < 0)
+            m_reader->dataAvailable.wait(&m_reader->mutex);
+        else
+            m_reader->dataAvailable.wait(&m_reader->mutex, static_cast<unsigned long>(timeout));
+    }
 
-    if (m_bufferUsed == m_buffer.length()) {
-        if (m_bufferPos == 0) {
-            resizeBuffer(m_bufferUsed <= s_maxBufferSize / 2 ? m_bufferUsed * 2
-                                                             : s_maxBufferSize);
-        } else {
-            resizeBuffer(m_bufferUsed);
-        }
+    const qint64 queued = m_reader->queuedSize;
+    if (queued == 0)
+        return 0;
+
+    const qint64 needed = bufferedAvailable() + queued;
+    Q_ASSERT(needed <= std::numeric_limits<int>::max());
+    if (m_bufferUsed + queued > m_buffer.length()) {
+        // grow in powers of two to keep the number of reallocations low
+        int newSize = m_buffer.length();
+        while (newSize < needed)
+            newSize = newSize <= std::numeric_limits<int>::max() / 2 ? newSize * 2 : int(needed);
+        resizeBuffer(newSize);
+    }
+
+    while (!m_reader->chunks.isEmpty()) {
+        const QByteArray chunk = m_reader->chunks.dequeue();
+        std::memcpy(m_buffer.data() + m_bufferUsed, chunk.constData(), static_cast<size_t>(chunk.size()));
+        m_bufferUsed += chunk.size();
     }
+    m_reader->queuedSize = 0;
+    m_reader->spaceAvailable.wakeAll();
 
-    const size_t read = fread(m_buffer.data() + m_bufferUsed, 1,
-                              static_cast<size_t>(m_buffer.length() - m_bufferUsed), stdin);
-    m_bufferUsed += static_cast<int>(read);
     Q_ASSERT(m_buffer.length() >= m_bufferUsed);
-    return static_cast<qint64>(read);
+    return queued;
 }
 
 bool PerfStdin::stdinAtEnd() const
 {
-    return feof(stdin) || ferror(stdin);
+    if (!m_reader)
+        return true;
+
+    QMutexLocker locker(&m_reader->mutex);
+    return m_reader->atEnd && m_reader->chunks.isEmpty();
 }
 
 bool PerfStdin::isSequential() const
@@ -23,6 +23,10 @@
 #include <QIODevice>
 #include <QTimer>
 
+#include <memory>
+
+class QThread;
+
 class PerfStdin final : public QIODevice
 {
     Q_OBJECT
@@ -41,14 +45,24 @@ protected:
 
 private:
     static const int s_minBufferSize = 1 << 10;
-    static const int s_maxBufferSize = 1 << 30;
+    // maximum amount of data read ahead, beyond that we stop draining stdin
+    static const int s_maxQueuedSize = 1 << 28;
+    static const int s_maxChunkSize = 1 << 20;
 
     void receiveData();
     void resizeBuffer(int newSize);
-    qint64 fillBuffer(qint64 targetSize = -1);
+    // move the data read by the reader thread into m_buffer, waiting up to @p timeout ms for
+    // more data if there is none yet, forever if @p timeout is negative
+    qint64 fillBuffer(int timeout = -1);
     qint64 bufferedAvailable() const { return m_bufferUsed - m_bufferPos; }
     bool stdinAtEnd() const;
 
+    // stdin is read on a separate thread, so that a pipe keeps being drained while we are busy
+    // analyzing the data we got already
+    struct Reader;
+    std::shared_ptr<Reader> m_reader;
+    QThread *m_readerThread = nullptr;
+
     QTimer m_timer;
     QByteArray m_buffer;
     int m_bufferPos = 0;
@@ -0,0 +1,105 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perfstringtable.h"
+
+#include <cstring>
+
+bool PerfStringTable::Key::operator==(const Key &other) const
+{
+    return hash == other.hash && size == other.size
+            && (size == 0 || std::memcmp(data, other.data, static_cast<size_t>(size)) == 0);
+}
+
+PerfStringTable::Key PerfStringTable::key(const QByteArray &string)
+{
+    Key key;
+    key.data = string.constData();
+    key.size = string.size();
+    key.hash = static_cast<uint>(qHashBits(key.data, static_cast<size_t>(key.size)));
+    return key;
+}
+
+qint32 PerfStringTable::find(const QByteArray &string) const
+{
+    const qint32 *id = m_ids.find(key(string));
+    return id ? *id : -1;
+}
+
+qint32 PerfStringTable::insert(const QByteArray &string, bool *inserted)
+{
+    Key stringKey = key(string);
+    if (const qint32 *id = m_ids.find(stringKey)) {
+        if (inserted)
+            *inserted = false;
+        return *id;
+    }
+
+    stringKey.data = store(string);
+    const qint32 id = m_strings.size();
+    m_strings.append(stringKey);
+    m_ids.insert(stringKey, id);
+    if (inserted)
+        *inserted = true;
+    return id;
+}
+
+QByteArray PerfStringTable::string(qint32 id) const
+{
+    if (id < 0 || id >= m_strings.size())
+        return {};
+    const Key &key = m_strings.at(id);
+    return QByteArray::fromRawData(key.data, key.size);
+}
+
+void PerfStringTable::clear()
+{
+    m_strings.clear();
+    m_ids.clear();
+    m_chunks.clear();
+    m_chunk = nullptr;
+    m_chunkUsed = ChunkSize;
+}
+
+const char *PerfStringTable::store(const QByteArray &string)
+{
+    const int size = string.size();
+
+    // Long strings get their own chunk, so that we don't waste the rest of the current one. Copy
+    // them, the caller's string may be raw data that is released later.
+    if (size > ChunkSize / 4) {
+        m_chunks.append(QByteArray(string.constData(), size));
+        return m_chunks.last().constData();
+    }
+
+    // Keep a terminating 0 after each string, so that the data can be passed to C APIs.
+    if (m_chunkUsed + size + 1 > ChunkSize) {
+        m_chunks.append(QByteArray(ChunkSize, Qt::Uninitialized));
+        m_chunk = m_chunks.last().data();
+        m_chunkUsed = 0;
+    }
+
+    char *data = m_chunk + m_chunkUsed;
+    if (size > 0)
+        std::memcpy(data, string.constData(), static_cast<size_t>(size));
+    data[size] = '\0';
+    m_chunkUsed += size + 1;
+    return data;
+}
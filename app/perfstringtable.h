@@ -0,0 +1,72 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#pragma once
+
+#include "perfflathash.h"
+
+#include <QByteArray>
+#include <QVector>
+
+// Strings with consecutive IDs, starting at 0. The characters are copied into large chunks of
+// memory that are never moved, so that each string costs one allocation only every few thousand
+// strings. The hash of each string is computed once and kept with it, so that looking up a
+// string compares the full characters only on a hash match.
+class PerfStringTable
+{
+public:
+    // @return the ID of @p string, or -1 if it wasn't inserted
+    qint32 find(const QByteArray &string) const;
+    // Insert @p string if it isn't in the table yet. @p inserted is set if it was new.
+    qint32 insert(const QByteArray &string, bool *inserted = nullptr);
+
+    // The returned array refers to the table's memory, which stays valid until the table is
+    // destroyed or cleared. Its data is 0-terminated.
+    QByteArray string(qint32 id) const;
+
+    int size() const { return m_strings.size(); }
+    void clear();
+
+private:
+    enum {
+        ChunkSize = 64 * 1024
+    };
+
+    struct Key
+    {
+        const char *data = nullptr;
+        int size = 0;
+        uint hash = 0;
+
+        bool operator==(const Key &other) const;
+    };
+    friend uint qHash(const Key &key, uint seed = 0) { return key.hash ^ seed; }
+
+    static Key key(const QByteArray &string);
+    const char *store(const QByteArray &string);
+
+    // indexed by ID
+    QVector<Key> m_strings;
+    PerfFlatHash<Key, qint32> m_ids;
+    // QVector moves the QByteArrays when growing, but not the characters they point to.
+    QVector<QByteArray> m_chunks;
+    char *m_chunk = nullptr;
+    int m_chunkUsed = ChunkSize;
+};
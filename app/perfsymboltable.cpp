@@ -33,6 +33,8 @@
 #include <QScopeGuard>
 #include <QStack>
 
+#include <algorithm>
+
 #include <dwarf.h>
 #include <elfutils/libdwelf.h>
 
@@ -60,6 +62,8 @@ PerfSymbolTable::PerfSymbolTable(qint32 pid, Dwfl_Callbacks *callbacks, PerfUnwi
     m_hasPerfMap(m_perfMapFile.exists()),
     m_cacheIsDirty(false),
     m_unwind(parent),
+    m_elfs(parent->paths()),
+    m_unwindCacheId(parent->newUnwindCacheId()),
     m_callbacks(callbacks),
     m_pid(pid)
 {
@@ -71,14 +75,16 @@ PerfSymbolTable::PerfSymbolTable(qint32 pid, Dwfl_Callbacks *callbacks, PerfUnwi
                      });
 
     m_dwfl = dwfl_begin(m_callbacks);
+    m_stackValues.setMaxSize(parent->maxStackValues());
 
 #if HAVE_DWFL_GET_DEBUGINFOD_CLIENT
     auto client = dwfl_get_debuginfod_client(m_dwfl);
     debuginfod_set_user_data(client, this);
     debuginfod_set_progressfn(client, [](debuginfod_client* client, long numerator, long denominator) {
         auto self = reinterpret_cast<PerfSymbolTable*>(debuginfod_get_user_data(client));
-        auto url = self->m_unwind->resolveString(QByteArray(debuginfod_get_url(client)));
-        self->m_unwind->sendDebugInfoDownloadProgress(self->m_currentFindDebugInfoModule, url, numerator, denominator);
+        self->m_unwind->sendDebugInfoDownloadProgress(self->m_currentFindDebugInfoModule,
+                                                      QByteArray(debuginfod_get_url(client)),
+                                                      numerator, denominator);
         // NOTE: eventually we could add a back channel to allow the user to cancel an ongoing download
         //       to do so, we'd have to return any non-zero value here then
         return 0;
@@ -231,8 +237,8 @@ void PerfSymbolTable::registerElf(const PerfRecordMmap &mmap, const QByteArray &
             ElfAndFile elf(fullPath);
             if (!elf.elf())
                 fullPath = QFileInfo();
-            else if (!m_firstElf.elf())
-                m_firstElf = std::move(elf);
+            else if (!m_firstElf)
+                m_firstElf = QSharedPointer<ElfAndFile>::create(std::move(elf));
         }
     } else { // kernel
         fullPath.setFile(m_unwind->systemRoot() + filePath);
@@ -249,6 +255,10 @@ void PerfSymbolTable::registerElf(const PerfRecordMmap &mmap, const QByteArray &
     // past frames.
     if (m_cacheIsDirty)
         clearCache();
+
+    // Even if nothing got invalidated, addresses that couldn't be unwound before may be mapped now.
+    ++m_unwindCacheId;
+    m_dsoSections.clear();
 }
 
 int PerfSymbolTable::insertSubprogram(CuDieRangeMapping *cudie, Dwarf_Die *top, Dwarf_Addr entry,
@@ -338,10 +348,14 @@ Dwfl_Module *PerfSymbolTable::reportElf(const PerfElfMap::ElfInfo& info)
     if (!info.isValid() || !info.isFile())
         return nullptr;
 
+    // The section data may belong to modules dwfl throws away now.
+    m_dsoSections.clear();
+    m_cfiTables.clear();
+
     dwfl_report_begin_add(m_dwfl);
     Dwfl_Module *ret = dwfl_report_elf(
-                m_dwfl, info.originalFileName.constData(),
-                info.localFile.absoluteFilePath().toLocal8Bit().constData(), -1, info.addr - info.pgoff,
+                m_dwfl, info.originalFileName().constData(),
+                info.localFilePath().constData(), -1, info.addr - info.pgoff,
                 false);
     if (!ret) {
         reportError(m_pid, info, dwfl_errmsg(dwfl_errno()));
@@ -362,6 +376,49 @@ Dwfl_Module *PerfSymbolTable::reportElf(const PerfElfMap::ElfInfo& info)
     return ret;
 }
 
+const char *PerfSymbolTable::dsoMemory(quint64 addr, int size)
+{
+    auto it = std::upper_bound(m_dsoSections.cbegin(), m_dsoSections.cend(), addr,
+                               [](quint64 addr, const DsoSection &section) {
+                                   return addr < section.start;
+                               });
+    if (it != m_dsoSections.cbegin()) {
+        const auto &section = *(it - 1);
+        if (addr + size <= section.end)
+            return section.data + (addr - section.start);
+        if (addr < section.end)
+            return nullptr; // crosses the end of the section
+    }
+
+    // TODO: Take the pgoff into account? Or does elf_getdata do that already?
+    auto mod = module(addr);
+    if (!mod)
+        return nullptr;
+
+    Dwarf_Addr offset = addr;
+    Dwarf_Addr bias;
+    Elf_Scn *scn = dwfl_module_address_section(mod, &offset, &bias);
+    if (!scn)
+        return nullptr;
+
+    Elf_Data *data = elf_getdata(scn, nullptr);
+    if (!data || !data->d_buf || data->d_size <= offset)
+        return nullptr;
+
+    // search again, reporting a new module in module() clears the sections
+    const DsoSection section = {addr - offset, addr - offset + data->d_size,
+                                static_cast<const char *>(data->d_buf)};
+    it = std::upper_bound(m_dsoSections.cbegin(), m_dsoSections.cend(), section.start,
+                          [](quint64 start, const DsoSection &section) {
+                              return start < section.start;
+                          });
+    m_dsoSections.insert(it - m_dsoSections.cbegin(), section);
+
+    if (offset + size > data->d_size)
+        return nullptr;
+    return section.data + offset;
+}
+
 Dwfl_Module *PerfSymbolTable::module(quint64 addr)
 {
     return module(addr, findElf(addr));
@@ -374,7 +431,7 @@ Dwfl_Module *PerfSymbolTable::module(quint64 addr, const PerfElfMap::ElfInfo &el
 
     if (elf.hasBaseAddr() && elf.baseAddr != elf.addr) {
         const auto base = m_elfs.findElf(elf.baseAddr);
-        if (base.addr == elf.baseAddr && !base.pgoff && elf.originalPath == base.originalPath && elf.addr != base.addr)
+        if (base.addr == elf.baseAddr && !base.pgoff && elf.originalPathId == base.originalPathId && elf.addr != base.addr)
             return module(addr, base);
     }
 
@@ -473,7 +530,8 @@ int PerfSymbolTable::findDebugInfo(Dwfl_Module *module, const char *moduleName,
                                    const char *file, const char *debugLink,
                                    GElf_Word crc, char **debugInfoFilename)
 {
-    m_currentFindDebugInfoModule = m_unwind->resolveString(QByteArray(moduleName));
+    // This may run in one of the unwinding threads, only resolve the string if we need to send it.
+    m_currentFindDebugInfoModule = QByteArray(moduleName);
     int ret = dwfl_standard_find_debuginfo(module, nullptr, moduleName, base, file,
                                            debugLink, crc, debugInfoFilename);
     if (ret >= 0 || !debugLink || strlen(debugLink) == 0)
@@ -487,7 +545,7 @@ int PerfSymbolTable::findDebugInfo(Dwfl_Module *module, const char *moduleName,
     if (!debugLinkFile.isFile()) {
         // fall-back to original file path with debug link file name
         const auto &elf = m_elfs.findElf(base);
-        const auto &path = QString::fromUtf8(elf.originalPath);
+        const auto &path = QString::fromUtf8(elf.originalPath());
         debugLinkFile = findDebugInfoFile(m_unwind->systemRoot(), path, debugLinkString);
     }
 
@@ -647,6 +705,38 @@ const char *findPltSymbol(Elf *elf, int index)
     return nullptr;
 }
 
+static bool hasSymtabSection(Elf *elf)
+{
+    size_t numSections = 0;
+    if (!elf || elf_getshdrnum(elf, &numSections) != 0)
+        return false;
+
+    for (size_t i = 0; i < numSections; ++i) {
+        auto *section = elf_getscn(elf, i);
+        if (const auto *shdr = elf64_getshdr(section)) {
+            if (shdr->sh_type == SHT_SYMTAB)
+                return true;
+        } else if (const auto *shdr = elf32_getshdr(section)) {
+            if (shdr->sh_type == SHT_SYMTAB)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Whether the symbols of @p mod come from a full .symtab, either in the ELF file itself or in its
+// separate debug file, rather than from .dynsym or .gnu_debugdata.
+static bool hasFullSymtab(Dwfl_Module *mod)
+{
+    Dwarf_Addr bias = 0;
+    if (hasSymtabSection(dwfl_module_getelf(mod, &bias)))
+        return true;
+
+    // dwfl_module_getsymtab() has already looked for the debug file, so this doesn't search again
+    auto *dwarf = dwfl_module_getdwarf(mod, &bias);
+    return dwarf && hasSymtabSection(dwarf_getelf(dwarf));
+}
+
 static QByteArray fakeSymbolFromSection(Dwfl_Module *mod, Dwarf_Addr addr)
 {
     Dwarf_Addr bias = 0;
@@ -690,6 +780,67 @@ static QByteArray fakeSymbolFromSection(Dwfl_Module *mod, Dwarf_Addr addr)
     return sym;
 }
 
+QByteArray PerfSymbolTable::buildId(Dwfl_Module *mod, const QByteArray &originalPath) const
+{
+    QByteArray buildId = m_unwind->buildId(originalPath);
+    if (buildId.isEmpty()) {
+        const unsigned char *id = nullptr;
+        GElf_Addr idVaddr = 0;
+        const int idLength = dwfl_module_build_id(mod, &id, &idVaddr);
+        if (idLength > 0)
+            buildId = QByteArray(reinterpret_cast<const char *>(id), idLength);
+    }
+    return buildId;
+}
+
+PerfCfiTable *PerfSymbolTable::cfiTable(Dwfl_Module *module, Dwarf_Addr *moduleStart)
+{
+    auto it = m_cfiTables.find(module);
+    if (it == m_cfiTables.end()) {
+        ModuleCfi cfi;
+        dwfl_module_info(module, nullptr, &cfi.start, nullptr, nullptr, nullptr, nullptr, nullptr);
+        // Without build-id we can't tell whether another process loaded the same file.
+        const QByteArray buildId = this->buildId(module, findElf(cfi.start).originalPath());
+        cfi.table = buildId.isEmpty() ? QSharedPointer<PerfCfiTable>::create()
+                                      : m_unwind->addressCache()->cfiTable(buildId);
+        it = m_cfiTables.insert(module, cfi);
+    }
+    *moduleStart = it->start;
+    return it->table.data();
+}
+
+PerfAddressCache::SymbolCache PerfSymbolTable::extractSymbols(Dwfl_Module *mod, const PerfElfMap::ElfInfo &elf,
+                                                              quint64 elfStart, bool isArmArch) const
+{
+    const auto cachePath = m_unwind->symbolCachePath();
+    if (cachePath.isEmpty())
+        return PerfAddressCache::extractSymbols(mod, elfStart, isArmArch);
+
+    const QByteArray buildId = this->buildId(mod, elf.originalPath());
+    if (buildId.isEmpty())
+        return PerfAddressCache::extractSymbols(mod, elfStart, isArmArch);
+
+    // the cache stores offsets relative to the module start, which doesn't depend on where
+    // the mapping we happen to look at begins
+    Dwarf_Addr moduleStart = 0;
+    dwfl_module_info(mod, nullptr, &moduleStart, nullptr, nullptr, nullptr, nullptr, nullptr);
+    const auto offsetDelta = static_cast<qint64>(elfStart - moduleStart);
+
+    const QString fileName = cachePath + QDir::separator() + QString::fromLatin1(buildId.toHex())
+            + (isArmArch ? QLatin1String(".arm.symbols") : QLatin1String(".symbols"));
+
+    PerfAddressCache::SymbolCache symbols;
+    if (PerfAddressCache::loadSymbolCache(fileName, &symbols, -offsetDelta))
+        return symbols;
+
+    symbols = PerfAddressCache::extractSymbols(mod, elfStart, isArmArch);
+    // Only persist complete tables. Otherwise a run that lacks the debug file would keep later
+    // runs that have it from ever extracting the full symbols.
+    if (hasFullSymtab(mod))
+        PerfAddressCache::saveSymbolCache(fileName, symbols, offsetDelta);
+    return symbols;
+}
+
 int PerfSymbolTable::lookupFrame(Dwarf_Addr ip, bool isKernel,
                                  bool *isInterworking)
 {
@@ -707,9 +858,9 @@ int PerfSymbolTable::lookupFrame(Dwarf_Addr ip, bool isKernel,
     qint32 actualPathId = -1;
     quint64 elfStart = 0;
     if (elf.isValid()) {
-        binaryId = m_unwind->resolveString(elf.originalFileName);
-        binaryPathId = m_unwind->resolveString(elf.originalPath);
-        actualPathId = m_unwind->resolveString(elf.localFile.absoluteFilePath().toUtf8());
+        binaryId = m_unwind->resolvePath(elf.originalFileNameId);
+        binaryPathId = m_unwind->resolvePath(elf.originalPathId);
+        actualPathId = m_unwind->resolvePath(elf.localFileId);
         elfStart = elf.hasBaseAddr() ? elf.baseAddr : elf.addr;
     }
 
@@ -726,14 +877,14 @@ int PerfSymbolTable::lookupFrame(Dwarf_Addr ip, bool isKernel,
     quint64 size = 0;
     quint64 relAddr = 0;
     if (mod) {
-        if (!addressCache->hasSymbolCache(elf.originalPath)) {
+        if (!addressCache->hasSymbolCache(elf.originalPath())) {
             // cache all symbols in a sorted lookup table and demangle them on-demand
             // note that the symbols within the symtab aren't necessarily sorted,
             // which makes searching repeatedly via dwfl_module_addrinfo potentially very slow
-            addressCache->setSymbolCache(elf.originalPath, PerfAddressCache::extractSymbols(mod, elfStart, isArmArch));
+            addressCache->setSymbolCache(elf.originalPath(), extractSymbols(mod, elf, elfStart, isArmArch));
         }
 
-        auto cachedAddrInfo = addressCache->findSymbol(elf.originalPath, addressLocation.address - elfStart);
+        auto cachedAddrInfo = addressCache->findSymbol(elf.originalPath(), addressLocation.address - elfStart);
         if (cachedAddrInfo.isValid()) {
             off = addressLocation.address - elfStart - cachedAddrInfo.offset;
             symname = cachedAddrInfo.symname;
@@ -744,10 +895,17 @@ int PerfSymbolTable::lookupFrame(Dwarf_Addr ip, bool isKernel,
             Dwarf_Addr bias = 0;
             functionLocation.address -= off; // in case we don't find anything better
 
-            if (!m_cuDieRanges.contains(mod))
-                m_cuDieRanges[mod] = PerfDwarfDieCache(mod);
+            auto dieCache = m_cuDieRanges.find(mod);
+            if (dieCache == m_cuDieRanges.end()) {
+                // Without build-id we can't tell whether another process loaded the same file.
+                const QByteArray buildId = this->buildId(mod, elf.originalPath());
+                dieCache = m_cuDieRanges.insert(
+                            mod, PerfDwarfDieCache(mod, buildId.isEmpty()
+                                                   ? QSharedPointer<ModuleDieRanges>()
+                                                   : addressCache->dieRanges(buildId)));
+            }
 
-            auto *cudie = m_cuDieRanges[mod].findCuDie(addressLocation.address);
+            auto *cudie = dieCache->findCuDie(addressLocation.address);
             if (cudie) {
                 bias = cudie->bias();
                 const auto offset = addressLocation.address - bias;
@@ -889,6 +1047,7 @@ bool PerfSymbolTable::containsAddress(quint64 address) const
 
 Dwfl *PerfSymbolTable::attachDwfl(const Dwfl_Thread_Callbacks *callbacks, PerfUnwind::UnwindInfo *unwindInfo)
 {
+    m_unwindInfo = unwindInfo;
     if (static_cast<pid_t>(m_pid) == dwfl_pid(m_dwfl))
         return m_dwfl; // Already attached, nothing to do
 
@@ -901,7 +1060,7 @@ Dwfl *PerfSymbolTable::attachDwfl(const Dwfl_Thread_Callbacks *callbacks, PerfUn
     if (!hasSampleRegsUser || !hasSampleStackUser)
         return nullptr;
 
-    if (!dwfl_attach_state(m_dwfl, m_firstElf.elf(), m_pid, callbacks, unwindInfo)) {
+    if (!dwfl_attach_state(m_dwfl, m_firstElf ? m_firstElf->elf() : nullptr, m_pid, callbacks, this)) {
         qWarning() << m_pid << "failed to attach state" << dwfl_errmsg(dwfl_errno());
         return nullptr;
     }
@@ -913,6 +1072,9 @@ void PerfSymbolTable::clearCache()
 {
     m_invalidAddressCache.clear();
     m_cuDieRanges.clear();
+    ++m_unwindCacheId;
+    m_dsoSections.clear();
+    m_cfiTables.clear();
     m_perfMap.clear();
     if (m_perfMapFile.isOpen())
         m_perfMapFile.reset();
@@ -932,7 +1094,6 @@ PerfSymbolTable::ElfAndFile &PerfSymbolTable::ElfAndFile::operator=(
         clear();
         m_elf = other.m_elf;
         m_file = other.m_file;
-        m_fullPath = std::move(other.m_fullPath);
         other.m_elf = nullptr;
         other.m_file = -1;
     }
@@ -954,7 +1115,6 @@ void PerfSymbolTable::ElfAndFile::clear()
 }
 
 PerfSymbolTable::ElfAndFile::ElfAndFile(const QFileInfo &fullPath)
-    : m_fullPath(fullPath)
 {
     m_file = eu_compat_open(fullPath.absoluteFilePath().toLocal8Bit().constData(),
                             O_RDONLY | O_BINARY);
@@ -969,7 +1129,7 @@ PerfSymbolTable::ElfAndFile::ElfAndFile(const QFileInfo &fullPath)
 }
 
 PerfSymbolTable::ElfAndFile::ElfAndFile(PerfSymbolTable::ElfAndFile &&other)
-    : m_elf(other.m_elf), m_file(other.m_file), m_fullPath(std::move(other.m_fullPath))
+    : m_elf(other.m_elf), m_file(other.m_file)
 {
     other.m_elf = nullptr;
     other.m_file = -1;
@@ -978,5 +1138,5 @@ PerfSymbolTable::ElfAndFile::ElfAndFile(PerfSymbolTable::ElfAndFile &&other)
 void PerfSymbolTable::initAfterFork(const PerfSymbolTable* parent)
 {
     m_elfs.copyDataFrom(&parent->m_elfs);
-    m_firstElf = ElfAndFile(parent->m_firstElf.fullPath());
+    m_firstElf = parent->m_firstElf;
 }
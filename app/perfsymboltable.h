@@ -26,6 +26,7 @@
 #pragma once
 
 #include "perfaddresscache.h"
+#include "perfcfitable.h"
 #include "perfdata.h"
 #include "perfelfmap.h"
 #include "perfunwind.h"
@@ -68,6 +69,10 @@ public:
                       const char *file, const char *debugLink,
                       GElf_Word crc, char **debugInfoFilename);
 
+    // Find the contents of the ELF section that @p size bytes at @p addr are mapped from. The
+    // sections are remembered until the modules get reported again or the cache is cleared.
+    const char *dsoMemory(quint64 addr, int size);
+
     // Look up a frame and all its inline parents and append them to the given vector.
     // If the frame hits an elf that hasn't been reported, yet, report it.
     int lookupFrame(Dwarf_Addr ip, bool isKernel, bool *isInterworking);
@@ -75,17 +80,37 @@ public:
     void updatePerfMap();
     bool containsAddress(quint64 address) const;
 
+    // Attach the dwfl for unwinding. The thread callbacks receive this symbol table as argument and
+    // unwind the given unwindInfo, until attachDwfl is called again.
     Dwfl *attachDwfl(const Dwfl_Thread_Callbacks *callbacks, PerfUnwind::UnwindInfo *unwindInfo);
+    PerfUnwind::UnwindInfo *unwindInfo() const { return m_unwindInfo; }
+    qint32 pid() const { return m_pid; }
+    // Stack words read while unwinding earlier samples. They survive clearCache().
+    PerfStackValues *stackValues() { return &m_stackValues; }
+    // Call frame information of @p module, which starts at @p moduleStart. It may be shared with
+    // other processes that load the same file.
+    PerfCfiTable *cfiTable(Dwfl_Module *module, Dwarf_Addr *moduleStart);
     void clearCache();
     bool cacheIsDirty() const { return m_cacheIsDirty; }
 
     void initAfterFork(const PerfSymbolTable *parent);
 
+    // Identifies the unwinding results of this process in PerfUnwind's unwind cache. The results
+    // are only valid as long as the mmaps and the dwfl don't change, so registerElf() and
+    // clearCache() switch to a new ID. The stale entries are evicted from the cache eventually.
+    quint64 unwindCacheId() const { return m_unwindCacheId; }
+
 private:
     // Report an mmap to dwfl and parse it for symbols and inlines, or simply return it if dwfl has
     // it already
     Dwfl_Module *reportElf(const PerfElfMap::ElfInfo& elf);
     QFileInfo findFile(const QString& path, const QString& fileName, const QByteArray& buildId = QByteArray()) const;
+    // Extract the symbols of @p mod, or read them from the symbol cache directory if they were
+    // extracted in an earlier run already. Only symbols from a full .symtab are stored.
+    PerfAddressCache::SymbolCache extractSymbols(Dwfl_Module *mod, const PerfElfMap::ElfInfo &elf,
+                                                 quint64 elfStart, bool isArmArch) const;
+    // Build-id of the file @p mod was loaded from, as recorded by perf or read from the file
+    QByteArray buildId(Dwfl_Module *mod, const QByteArray &originalPath) const;
 
     class ElfAndFile {
     public:
@@ -98,32 +123,48 @@ private:
         ~ElfAndFile();
 
         Elf *elf() const { return m_elf; }
-        QFileInfo fullPath() const { return m_fullPath; }
 
     private:
         void clear();
 
         Elf *m_elf = nullptr;
         int m_file = -1;
-        QFileInfo m_fullPath;
+    };
+
+    struct DsoSection {
+        quint64 start;
+        quint64 end;
+        const char *data;
     };
 
     QFile m_perfMapFile;
     QVector<PerfMapSymbol> m_perfMap;
+    // Sections read by dsoMemory(), sorted by start address
+    QVector<DsoSection> m_dsoSections;
     bool m_hasPerfMap;
     bool m_cacheIsDirty;
 
     PerfUnwind *m_unwind;
     Dwfl *m_dwfl;
-    // elf used to detect architecture
-    ElfAndFile m_firstElf;
+    // elf used to detect architecture, shared with forked children. dwfl_attach_state() only reads
+    // the ELF header from it, which libelf has already loaded in elf_begin().
+    QSharedPointer<ElfAndFile> m_firstElf;
 
     PerfElfMap m_elfs;
     PerfAddressCache::OffsetAddressCache m_invalidAddressCache;
     QHash<Dwfl_Module*, PerfDwarfDieCache> m_cuDieRanges;
+    quint64 m_unwindCacheId;
+    PerfStackValues m_stackValues;
+    struct ModuleCfi
+    {
+        QSharedPointer<PerfCfiTable> table;
+        Dwarf_Addr start = 0;
+    };
+    QHash<Dwfl_Module *, ModuleCfi> m_cfiTables;
     Dwfl_Callbacks *m_callbacks;
+    PerfUnwind::UnwindInfo *m_unwindInfo = nullptr;
     qint32 m_pid;
-    qint32 m_currentFindDebugInfoModule = -1;
+    QByteArray m_currentFindDebugInfoModule;
 
     QByteArray symbolFromPerfMap(quint64 ip, GElf_Off *offset) const;
     int parseDie(CuDieRangeMapping *cudie, Dwarf_Die *top, quint64 offset, quint64 size, quint64 relAddr, qint32 binaryId, qint32 binaryPathId, qint32 actualPathId, bool isKernel,
@@ -0,0 +1,251 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perftimeindex.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+namespace {
+const quint32 s_timeIndexMagic = 0x50544958;
+const quint32 s_timeIndexVersion = 3;
+
+// bytes of the perf.data file that are hashed from its start and from either end of each round
+const qint64 s_hashedHeaderSize = 4096;
+const qint64 s_hashedRoundSize = 32;
+
+bool hashBytes(QCryptographicHash *hash, QFile *file, qint64 pos, qint64 size)
+{
+    if (!file->seek(pos))
+        return false;
+    const QByteArray bytes = file->read(size);
+    if (bytes.size() != size)
+        return false;
+    hash->addData(bytes);
+    return true;
+}
+
+qint64 modificationTime(const QString &dataFileName)
+{
+    const QDateTime time = QFileInfo(dataFileName).lastModified();
+    return time.isValid() ? time.toMSecsSinceEpoch() : -1;
+}
+}
+
+void PerfTimeIndex::addSample(quint64 time)
+{
+    m_current.minTime = qMin(m_current.minTime, time);
+    m_current.maxTime = qMax(m_current.maxTime, time);
+    ++m_current.numSamples;
+}
+
+void PerfTimeIndex::addUntimedSample()
+{
+    // we can't tell where the sample belongs, so the round must never be skipped
+    m_current.minTime = 0;
+    m_current.maxTime = std::numeric_limits<quint64>::max();
+    ++m_current.numSamples;
+}
+
+void PerfTimeIndex::finishRound(qint64 end)
+{
+    const qint64 begin = m_rounds.isEmpty() ? 0 : m_rounds.last().end;
+    if (end <= begin)
+        return;
+
+    m_current.end = end;
+    m_rounds.append(m_current);
+    m_current = Round();
+}
+
+void PerfTimeIndex::clear()
+{
+    m_rounds.clear();
+    m_current = Round();
+}
+
+QVector<PerfTimeIndex::Range> PerfTimeIndex::ranges(quint64 timeFrom, quint64 timeTo) const
+{
+    int first = -1;
+    int last = -1;
+    for (int i = 0, size = m_rounds.size(); i < size; ++i) {
+        const Round &round = m_rounds.at(i);
+        if (round.hasSamples() && round.minTime <= timeTo && round.maxTime >= timeFrom) {
+            if (first == -1)
+                first = i;
+            last = i;
+        }
+    }
+
+    QVector<Range> ranges;
+    if (first == -1)
+        return ranges;
+
+    const int end = qMin(last + 2, m_rounds.size());
+    qint64 begin = 0;
+    for (int i = 0; i < end; ++i) {
+        const Round &round = m_rounds.at(i);
+        const bool statesOnly = i < first || i > last;
+        if (!statesOnly || round.numStateEvents > 0) {
+            if (!ranges.isEmpty() && ranges.last().end == begin && ranges.last().statesOnly == statesOnly)
+                ranges.last().end = round.end;
+            else
+                ranges.append({begin, round.end, statesOnly});
+        }
+        begin = round.end;
+    }
+    return ranges;
+}
+
+quint64 PerfTimeIndex::numSamples(const QVector<Range> &ranges) const
+{
+    quint64 numSamples = 0;
+    qint64 begin = 0;
+    auto range = ranges.cbegin();
+    for (const Round &round : m_rounds) {
+        while (range != ranges.cend() && range->end <= begin)
+            ++range;
+        if (range == ranges.cend())
+            break;
+        if (!range->statesOnly && range->begin <= begin && round.end <= range->end)
+            numSamples += round.numSamples;
+        begin = round.end;
+    }
+    return numSamples;
+}
+
+QByteArray PerfTimeIndex::hashData(const QString &dataFileName, qint64 dataOffset,
+                                   const QVector<Round> &rounds)
+{
+    // Unbuffered, as we only read a few bytes from each round.
+    QFile file(dataFileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        return {};
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!hashBytes(&hash, &file, 0, qMin(dataOffset, s_hashedHeaderSize)))
+        return {};
+
+    qint64 begin = 0;
+    for (const Round &round : rounds) {
+        const qint64 size = qMin(round.end - begin, s_hashedRoundSize);
+        if (!hashBytes(&hash, &file, dataOffset + begin, size)
+                || !hashBytes(&hash, &file, dataOffset + round.end - size, size)) {
+            return {};
+        }
+        begin = round.end;
+    }
+    return hash.result();
+}
+
+bool PerfTimeIndex::save(const QString &fileName, const QString &dataFileName, qint64 dataOffset,
+                         qint64 dataSize) const
+{
+    const QByteArray dataHash = hashData(dataFileName, dataOffset, m_rounds);
+    if (dataHash.isEmpty()) {
+        qWarning() << "Failed to read perf.data file" << dataFileName << "for the time index";
+        return false;
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to open time index file for writing" << fileName << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << s_timeIndexMagic << s_timeIndexVersion << dataOffset << dataSize
+           << modificationTime(dataFileName) << quint32(m_rounds.size());
+    for (const Round &round : m_rounds)
+        stream << round.end << round.minTime << round.maxTime << round.numSamples
+               << round.numStateEvents;
+    stream << dataHash;
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "Failed to write time index file" << fileName << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool PerfTimeIndex::load(const QString &fileName, const QString &dataFileName, qint64 dataOffset,
+                         qint64 dataSize)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint64 fileDataOffset = 0;
+    qint64 fileDataSize = 0;
+    qint64 fileModificationTime = 0;
+    quint32 numRounds = 0;
+    stream >> magic >> version >> fileDataOffset >> fileDataSize >> fileModificationTime
+           >> numRounds;
+    if (magic != s_timeIndexMagic || version != s_timeIndexVersion) {
+        qWarning() << "Ignoring incompatible time index file" << fileName;
+        return false;
+    }
+    if (fileDataOffset != dataOffset || fileDataSize != dataSize
+            || fileModificationTime != modificationTime(dataFileName)) {
+        qWarning() << "Ignoring time index file" << fileName << "of a different perf.data file";
+        return false;
+    }
+
+    // each round takes 32 bytes
+    QVector<Round> rounds;
+    rounds.reserve(static_cast<int>(qMin(numRounds, quint32(file.size() / 32))));
+    qint64 begin = 0;
+    for (quint32 i = 0; i < numRounds && stream.status() == QDataStream::Ok; ++i) {
+        Round round;
+        stream >> round.end >> round.minTime >> round.maxTime >> round.numSamples
+               >> round.numStateEvents;
+        if (round.end <= begin || round.end > dataSize)
+            break;
+        begin = round.end;
+        rounds.append(round);
+    }
+    QByteArray dataHash;
+    stream >> dataHash;
+
+    if (stream.status() != QDataStream::Ok || rounds.size() != static_cast<int>(numRounds)
+            || begin != dataSize || dataHash.isEmpty()) {
+        qWarning() << "Ignoring broken time index file" << fileName;
+        return false;
+    }
+
+    // The rounds have to end in the same places, otherwise we would seek into the middle of
+    // records.
+    if (hashData(dataFileName, dataOffset, rounds) != dataHash) {
+        qWarning() << "Ignoring time index file" << fileName << "of a different perf.data file";
+        return false;
+    }
+
+    m_rounds = rounds;
+    m_current = Round();
+    return true;
+}
@@ -0,0 +1,95 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#pragma once
+
+#include <QString>
+#include <QVector>
+
+#include <limits>
+
+// Sparse index of the data section of a perf.data file. perf writes a FINISHED_ROUND record after
+// flushing the buffers of all CPUs. For each round between two of those records, the index holds
+// where it ends, the range of its sample times, how many samples and how many other records it
+// contains. A reader that is only interested in a time window can then skip the samples before the
+// window, skip rounds without any other records altogether and stop reading after the window.
+class PerfTimeIndex
+{
+public:
+    struct Round
+    {
+        // Relative to the start of the data section. A round starts where the previous one ends.
+        qint64 end = 0;
+        quint64 minTime = std::numeric_limits<quint64>::max();
+        quint64 maxTime = 0;
+        quint32 numSamples = 0;
+        // records other than samples and FINISHED_ROUND, e.g. mmaps, comms and compressed records
+        quint32 numStateEvents = 0;
+
+        bool hasSamples() const { return minTime <= maxTime; }
+    };
+
+    // Part of the data section that has to be read. If @c statesOnly is set, samples are skipped.
+    struct Range
+    {
+        qint64 begin = 0;
+        qint64 end = 0;
+        bool statesOnly = false;
+    };
+
+    // Building the index while reading the data section from start to end.
+    void addSample(quint64 time);
+    void addUntimedSample();
+    void addStateEvent() { ++m_current.numStateEvents; }
+    void finishRound(qint64 end);
+
+    const QVector<Round> &rounds() const { return m_rounds; }
+    bool isEmpty() const { return m_rounds.isEmpty(); }
+    void clear();
+
+    // The ranges to read for the samples recorded between @p timeFrom and @p timeTo, inclusive.
+    // The rounds before the first round with such samples are only read for their other records,
+    // as is the round right after the last one: the times of neighbouring rounds may overlap.
+    QVector<Range> ranges(quint64 timeFrom, quint64 timeTo) const;
+    // The number of samples in the rounds of @p ranges that aren't @c statesOnly. This is an
+    // upper bound for the samples in the window the ranges were created for.
+    quint64 numSamples(const QVector<Range> &ranges) const;
+
+    // A fingerprint of the perf.data file @p dataFileName is recorded with the index, so that it
+    // isn't used for a different file: the data section, the modification time, and a hash of the
+    // file header and of the first and last bytes of each round.
+    bool save(const QString &fileName, const QString &dataFileName, qint64 dataOffset,
+              qint64 dataSize) const;
+    // Returns false without a warning if @p fileName doesn't exist.
+    bool load(const QString &fileName, const QString &dataFileName, qint64 dataOffset,
+              qint64 dataSize);
+
+private:
+    static QByteArray hashData(const QString &dataFileName, qint64 dataOffset,
+                               const QVector<Round> &rounds);
+
+    QVector<Round> m_rounds;
+    Round m_current;
+};
+
+QT_BEGIN_NAMESPACE
+Q_DECLARE_TYPEINFO(PerfTimeIndex::Round, Q_MOVABLE_TYPE);
+Q_DECLARE_TYPEINFO(PerfTimeIndex::Range, Q_MOVABLE_TYPE);
+QT_END_NAMESPACE
@@ -25,12 +25,22 @@
 #include <QDebug>
 #include <QDir>
 #include <QVersionNumber>
+#include <QtAlgorithms>
 #include <QtEndian>
 
+#include <algorithm>
 #include <cstring>
+#include <limits>
+#include <vector>
 
 const qint32 PerfUnwind::s_kernelPid = -1;
 
+// Limits the memory used for unwound, but not yet analyzed samples
+static const int s_maxPendingSamples = 1 << 14;
+
+// Upper bound for the CPU numbers samples are buffered by if the recording doesn't tell
+static const quint32 s_maxCpus = 1 << 12;
+
 uint qHash(const PerfUnwind::Location &location, uint seed)
 {
     QtPrivate::QHashCombine hash;
@@ -49,6 +59,37 @@ bool operator==(const PerfUnwind::Location &a, const PerfUnwind::Location &b)
             && a.column == b.column;
 }
 
+PerfUnwind::UnwindKey::UnwindKey(quint64 cacheId, const PerfRecordSample &sample, uint stackHash)
+    : cacheId(cacheId)
+    , registerAbi(sample.registerAbi())
+    , registers(sample.registers())
+    , stack(sample.userStack())
+    , stackHash(stackHash)
+{
+}
+
+uint PerfUnwind::UnwindKey::hashStack(const QByteArray &stack)
+{
+    return static_cast<uint>(qHashBits(stack.constData(), static_cast<size_t>(stack.size())));
+}
+
+bool PerfUnwind::UnwindKey::operator==(const UnwindKey &other) const
+{
+    // compare the cheap parts first, the stacks are only compared on a likely hit
+    return stackHash == other.stackHash && cacheId == other.cacheId
+            && registerAbi == other.registerAbi && registers == other.registers
+            && stack == other.stack;
+}
+
+uint qHash(const PerfUnwind::UnwindKey &key, uint seed)
+{
+    QtPrivate::QHashCombine hash;
+    seed = hash(seed, key.stackHash);
+    seed = hash(seed, key.cacheId);
+    seed = hash(seed, key.registerAbi);
+    return hash(seed, key.registers);
+}
+
 static pid_t nextThread(Dwfl *dwfl, void *arg, void **threadArg)
 {
     /* Stop after first thread. */
@@ -82,41 +123,31 @@ static quint64 registerAbi(const PerfRecordSample *sample)
     return abi - 1;
 }
 
-static bool accessDsoMem(const PerfUnwind::UnwindInfo *ui, Dwarf_Addr addr,
+static bool accessDsoMem(PerfSymbolTable *symbolTable, Dwarf_Addr addr,
                          Dwarf_Word *result, int wordWidth)
 {
     Q_ASSERT(wordWidth > 0);
-    // TODO: Take the pgoff into account? Or does elf_getdata do that already?
-    auto mod = ui->unwind->symbolTable(ui->sample->pid())->module(addr);
-    if (!mod)
+    const char *memory = symbolTable->dsoMemory(addr, wordWidth);
+    if (!memory)
         return false;
 
-    Dwarf_Addr bias;
-    Elf_Scn *section = dwfl_module_address_section(mod, &addr, &bias);
-
-    if (section) {
-        Elf_Data *data = elf_getdata(section, nullptr);
-        if (data && data->d_buf && data->d_size > addr) {
-            doMemcpy(result, static_cast<char *>(data->d_buf) + addr, wordWidth);
-            return true;
-        }
-    }
-
-    return false;
+    doMemcpy(result, memory, wordWidth);
+    return true;
 }
 
 static bool memoryRead(Dwfl *dwfl, Dwarf_Addr addr, Dwarf_Word *result, void *arg)
 {
     Q_UNUSED(dwfl)
 
-    auto* ui = static_cast<PerfUnwind::UnwindInfo*>(arg);
+    auto *symbolTable = static_cast<PerfSymbolTable *>(arg);
+    auto *ui = symbolTable->unwindInfo();
     const int wordWidth =
             PerfRegisterInfo::s_wordWidth[ui->unwind->architecture()][registerAbi(ui->sample)];
 
     /* Check overflow. */
     if (addr + sizeof(Dwarf_Word) < addr) {
         qDebug() << "Invalid memory read requested by dwfl" << Qt::hex << addr;
-        ui->firstGuessedFrame = ui->frames.length();
+        ui->firstGuessedFrame = ui->numFrames();
         return false;
     }
 
@@ -134,26 +165,24 @@ static bool memoryRead(Dwfl *dwfl, Dwarf_Addr addr, Dwarf_Word *result, void *ar
             qWarning() << "DWARF unwind tried to access kernel space" << Qt::hex << addr;
             return false;
         }
-        if (!accessDsoMem(ui, addr, result, wordWidth)) {
-            ui->firstGuessedFrame = ui->frames.length();
-            const QHash<quint64, Dwarf_Word> &stackValues = ui->stackValues[ui->sample->pid()];
-            auto it = stackValues.find(addr);
-            if (it == stackValues.end()) {
+        if (!accessDsoMem(symbolTable, addr, result, wordWidth)) {
+            ui->firstGuessedFrame = ui->numFrames();
+            quint64 value = 0;
+            if (!symbolTable->stackValues()->find(addr, &value))
                 return false;
-            } else {
-                *result = *it;
-            }
+            *result = value;
+            ui->usedStackValues = true;
         }
     } else {
         doMemcpy(result, &(stack.data()[addr - start]), wordWidth);
-        ui->stackValues[ui->sample->pid()][addr] = *result;
+        symbolTable->stackValues()->insert(addr, *result);
     }
     return true;
 }
 
 static bool setInitialRegisters(Dwfl_Thread *thread, void *arg)
 {
-    const PerfUnwind::UnwindInfo *ui = static_cast<PerfUnwind::UnwindInfo *>(arg);
+    const PerfUnwind::UnwindInfo *ui = static_cast<PerfSymbolTable *>(arg)->unwindInfo();
     const quint64 abi = registerAbi(ui->sample);
     const uint architecture = ui->unwind->architecture();
     const int numRegs = PerfRegisterInfo::s_numRegisters[architecture][abi];
@@ -247,10 +276,17 @@ PerfUnwind::PerfUnwind(QIODevice* output, const QString& systemRoot, const QStri
     m_extraLibsPath(extraLibsPath), m_appPath(appPath), m_debugPath(debugPath),
     m_kallsymsPath(QDir::rootPath() + defaultKallsymsPath()), m_ignoreKallsymsBuildId(false),
     m_customPerfMapPath(customPerfMapPath), m_lastEventBufferSize(1 << 20), m_maxEventBufferSize(1 << 30),
-    m_targetEventBufferSize(1 << 25), m_eventBufferSize(0), m_timeOrderViolations(0), m_lastFlushMaxTime(0)
+    m_targetEventBufferSize(1 << 25), m_eventBufferSize(0), m_timeOrderViolations(0), m_lastFlushMaxTime(0),
+    m_unwindCache(1 << 25)
 {
     m_stats.enabled = printStats;
     m_currentUnwind.unwind = this;
+
+    m_outputBufferDevice.setBuffer(&m_outputBuffer);
+    m_outputBufferDevice.open(QIODevice::WriteOnly);
+    m_outputBuffer.reserve(static_cast<int>(m_outputBufferSize));
+    m_outputStream.setDevice(&m_outputBufferDevice);
+
     m_offlineCallbacks.find_elf = dwfl_build_id_find_elf;
     m_offlineCallbacks.find_debuginfo = find_debuginfo;
     m_offlineCallbacks.section_address = dwfl_offline_section_address;
@@ -299,9 +335,34 @@ PerfUnwind::~PerfUnwind()
         out << "max time: " << m_stats.maxTime << "\n";
         out << "max time between rounds: " << m_stats.maxTimeBetweenRounds << "\n";
         out << "max reorder time: " << m_stats.maxReorderTime << "\n";
+    } else if (m_printCacheStats) {
+        // Only a run that converts the data looks up any addresses. Its output is the data
+        // stream, so report on stderr.
+        const quint64 lookups = m_addressCache.numLookups();
+        const quint64 hits = m_addressCache.numHits();
+        QTextStream out(stderr);
+        out << "address cache lookups: " << lookups << "\n";
+        out << "address cache hits: " << hits << "\n";
+        out << "address cache hit rate: "
+            << (lookups ? 100.0 * static_cast<double>(hits) / static_cast<double>(lookups) : 0.0)
+            << "%\n";
     }
 }
 
+void PerfUnwind::setUnwindThreads(int unwindThreads)
+{
+    m_unwindThreads = unwindThreads;
+    m_unwindThreadPool.setMaxThreadCount(unwindThreads);
+}
+
+void PerfUnwind::setOutputBufferSize(uint size)
+{
+    flushOutput();
+    m_outputBufferSize = size;
+    // reserving the capacity also makes sure it's kept when we clear the buffer after flushing
+    m_outputBuffer.reserve(static_cast<int>(qMin(size, uint(std::numeric_limits<int>::max() / 2))));
+}
+
 void PerfUnwind::setMaxEventBufferSize(uint size)
 {
     m_maxEventBufferSize = size;
@@ -331,6 +392,14 @@ bool PerfUnwind::hasTracePointAttributes() const
     return false;
 }
 
+quint64 PerfUnwind::newUnwindCacheId()
+{
+    // PerfSymbolTable counts up the lower half whenever its results become invalid.
+    const quint64 id = m_nextUnwindCacheId;
+    m_nextUnwindCacheId += Q_UINT64_C(1) << 32;
+    return id;
+}
+
 PerfSymbolTable *PerfUnwind::symbolTable(qint32 pid)
 {
     PerfSymbolTable *&symbolTable = m_symbolTables[pid];
@@ -344,14 +413,39 @@ void PerfUnwind::registerElf(const PerfRecordMmap &mmap)
     bufferEvent(mmap, &m_mmapBuffer, &m_stats.numMmapsInRound);
 }
 
-void PerfUnwind::sendBuffer(const QByteArray &buffer)
+QDataStream &PerfUnwind::beginEvent()
 {
-    if (m_stats.enabled)
+    Q_ASSERT(m_eventStart == -1);
+    m_eventStart = m_outputBuffer.size();
+
+    // reserve space for the size, which we only know once the event is serialized
+    const qint32 size = 0;
+    m_outputBufferDevice.write(reinterpret_cast<const char *>(&size), sizeof(qint32));
+    return m_outputStream;
+}
+
+void PerfUnwind::endEvent()
+{
+    Q_ASSERT(m_eventStart >= 0);
+    const qint32 size = qToLittleEndian(qint32(m_outputBuffer.size() - m_eventStart - int(sizeof(qint32))));
+    std::memcpy(m_outputBuffer.data() + m_eventStart, &size, sizeof(qint32));
+    m_eventStart = -1;
+
+    if (static_cast<uint>(m_outputBuffer.size()) >= m_outputBufferSize)
+        flushOutput();
+}
+
+void PerfUnwind::flushOutput()
+{
+    Q_ASSERT(m_eventStart == -1);
+    if (m_outputBuffer.isEmpty())
         return;
 
-    qint32 size = qToLittleEndian(buffer.length());
-    m_output->write(reinterpret_cast<char *>(&size), sizeof(quint32));
-    m_output->write(buffer);
+    if (!m_stats.enabled)
+        m_output->write(m_outputBuffer.constData(), m_outputBuffer.size());
+
+    m_outputBuffer.resize(0);
+    m_outputBufferDevice.seek(0);
 }
 
 void PerfUnwind::comm(const PerfRecordComm &comm)
@@ -407,12 +501,11 @@ void PerfUnwind::sendAttributes(qint32 id, const PerfEventAttributes &attributes
 {
     const qint32 attrNameId = resolveString(name);
 
-    QByteArray buffer;
-    QDataStream(&buffer, QIODevice::WriteOnly) << static_cast<quint8>(AttributesDefinition)
-                                               << id << attributes.type()
-                                               << attributes.config() << attrNameId
-                                               << attributes.usesFrequency() << attributes.frequenyOrPeriod();
-    sendBuffer(buffer);
+    beginEvent() << static_cast<quint8>(AttributesDefinition)
+                 << id << attributes.type()
+                 << attributes.config() << attrNameId
+                 << attributes.usesFrequency() << attributes.frequenyOrPeriod();
+    endEvent();
 }
 
 void PerfUnwind::sendEventFormat(qint32 id, const EventFormat &format)
@@ -426,10 +519,9 @@ void PerfUnwind::sendEventFormat(qint32 id, const EventFormat &format)
     for (const FormatField &field : format.fields)
         resolveString(field.name);
 
-    QByteArray buffer;
-    QDataStream(&buffer, QIODevice::WriteOnly) << static_cast<quint8>(TracePointFormat) << id
-                                               << systemId << nameId << format.flags;
-    sendBuffer(buffer);
+    beginEvent() << static_cast<quint8>(TracePointFormat) << id
+                 << systemId << nameId << format.flags;
+    endEvent();
 }
 
 void PerfUnwind::lost(const PerfRecordLost &lost)
@@ -442,6 +534,7 @@ void PerfUnwind::lost(const PerfRecordLost &lost)
 void PerfUnwind::features(const PerfFeatures &features)
 {
     tracing(features.tracingData());
+    m_numCpus = features.nrCpus().available;
 
     const auto &eventDescs = features.eventDesc().eventDescs;
     for (const auto &desc : eventDescs)
@@ -456,23 +549,22 @@ void PerfUnwind::features(const PerfFeatures &features)
         }
     }
 
-    QByteArray buffer;
-    QDataStream(&buffer, QIODevice::WriteOnly) << static_cast<quint8>(FeaturesDefinition)
-                                               << features.hostName()
-                                               << features.osRelease()
-                                               << features.version()
-                                               << features.architecture()
-                                               << features.nrCpus()
-                                               << features.cpuDesc()
-                                               << features.cpuId()
-                                               << features.totalMem()
-                                               << features.cmdline()
-                                               << features.buildIds()
-                                               << features.cpuTopology()
-                                               << features.numaTopology()
-                                               << features.pmuMappings()
-                                               << features.groupDescs();
-    sendBuffer(buffer);
+    beginEvent() << static_cast<quint8>(FeaturesDefinition)
+                 << features.hostName()
+                 << features.osRelease()
+                 << features.version()
+                 << features.architecture()
+                 << features.nrCpus()
+                 << features.cpuDesc()
+                 << features.cpuId()
+                 << features.totalMem()
+                 << features.cmdline()
+                 << features.buildIds()
+                 << features.cpuTopology()
+                 << features.numaTopology()
+                 << features.pmuMappings()
+                 << features.groupDescs();
+    endEvent();
 
     const auto buildIds = features.buildIds();
     m_buildIds.reserve(buildIds.size());
@@ -512,21 +604,20 @@ QDataStream &operator<<(QDataStream &stream, const PerfUnwind::Symbol &symbol)
 static int frameCallback(Dwfl_Frame *state, void *arg)
 {
     Dwarf_Addr pc = 0;
-    auto* ui = static_cast<PerfUnwind::UnwindInfo*>(arg);
+    auto *symbolTable = static_cast<PerfSymbolTable *>(arg);
+    auto *ui = symbolTable->unwindInfo();
 
     // do not query for activation directly, as this could potentially advance
     // the unwinder internally - we must first ensure the module for the pc
     // is reported
     if (!dwfl_frame_pc(state, &pc, nullptr)
-            || (ui->maxFrames != -1 && ui->frames.length() > ui->maxFrames)
+            || (ui->maxFrames != -1 && ui->numFrames() > ui->maxFrames)
             || pc == 0) {
-        ui->firstGuessedFrame = ui->frames.length();
+        ui->firstGuessedFrame = ui->numFrames();
         qWarning() << dwfl_errmsg(dwfl_errno()) << ui->firstGuessedFrame;
         return DWARF_CB_ABORT;
     }
 
-    auto* symbolTable = ui->unwind->symbolTable(ui->sample->pid());
-
     // ensure the module is reported
     // if that fails, we will still try to unwind based on frame pointer
     symbolTable->module(pc);
@@ -536,6 +627,13 @@ static int frameCallback(Dwfl_Frame *state, void *arg)
     dwfl_frame_pc(state, &pc, &isactivation);
     Dwarf_Addr pc_adjusted = pc - (isactivation ? 0 : 1);
 
+    if (ui->framePcs) {
+        if (symbolTable->cacheIsDirty())
+            return DWARF_CB_ABORT;
+        ui->framePcs->append(pc_adjusted);
+        return DWARF_CB_OK;
+    }
+
     // isKernel = false as unwinding generally only works on user code
     bool isInterworking = false;
     const auto frame = symbolTable->lookupFrame(pc_adjusted, false, &isInterworking);
@@ -550,11 +648,44 @@ static int frameCallback(Dwfl_Frame *state, void *arg)
 
 void PerfUnwind::unwindStack()
 {
-    Dwfl *dwfl = symbolTable(m_currentUnwind.sample->pid())->attachDwfl(&threadCallbacks, &m_currentUnwind);
+    PerfSymbolTable *symbols = symbolTable(m_currentUnwind.sample->pid());
+    const int numPrecedingFrames = m_currentUnwind.frames.length();
+
+    // Identical stacks with identical registers unwind to the same frames, unless we have to
+    // retry with LR at an interworking veneer.
+    const bool useCache = m_unwindCache.maxCost() > 0 && !m_currentUnwind.isInterworking;
+    if (useCache) {
+        const auto *cached = m_unwindCache.object(
+                    UnwindKey(symbols->unwindCacheId(), *m_currentUnwind.sample, currentStackHash()));
+        if (cached && cached->numPrecedingFrames == numPrecedingFrames) {
+            m_currentUnwind.frames += cached->frames;
+            if (cached->firstGuessedFrame != -1)
+                m_currentUnwind.firstGuessedFrame = numPrecedingFrames + cached->firstGuessedFrame;
+            return;
+        }
+    }
+
+    if (m_unwindMode != DwarfUnwinding) {
+        m_currentUnwind.usedStackValues = false;
+        const bool isUnwound = m_unwindMode == CfiUnwinding ? unwindCfi(symbols)
+                                                            : unwindFramePointers(symbols);
+        if (isUnwound || m_unwindMode == FramePointerUnwinding) {
+            if (useCache)
+                cacheUnwoundStack(symbols, numPrecedingFrames);
+            return;
+        }
+
+        // The frame pointer chain is broken or the CFI needs dwfl, start over with DWARF.
+        m_currentUnwind.frames.resize(numPrecedingFrames);
+        m_currentUnwind.firstGuessedFrame = -1;
+    }
+
+    Dwfl *dwfl = symbols->attachDwfl(&threadCallbacks, &m_currentUnwind);
     if (!dwfl)
         return;
 
-    dwfl_getthread_frames(dwfl, m_currentUnwind.sample->pid(), frameCallback, &m_currentUnwind);
+    m_currentUnwind.usedStackValues = false;
+    dwfl_getthread_frames(dwfl, m_currentUnwind.sample->pid(), frameCallback, symbols);
     if (m_currentUnwind.isInterworking) {
         QVector<qint32> savedFrames = m_currentUnwind.frames;
 
@@ -566,13 +697,259 @@ void PerfUnwind::unwindStack()
         // has to be a return address in LR, provided by the caller.
         // So, just try again, and make setInitialRegisters use LR for IP.
         m_currentUnwind.frames.resize(1); // Keep the actual veneer frame
-        dwfl_getthread_frames(dwfl, m_currentUnwind.sample->pid(), frameCallback, &m_currentUnwind);
+        dwfl_getthread_frames(dwfl, m_currentUnwind.sample->pid(), frameCallback, symbols);
 
         // If the LR trick didn't result in a longer stack trace than the regular unwinding, just
         // revert it.
         if (savedFrames.length() > m_currentUnwind.frames.length())
             m_currentUnwind.frames.swap(savedFrames);
+    } else if (useCache) {
+        cacheUnwoundStack(symbols, numPrecedingFrames);
+    }
+}
+
+bool PerfUnwind::unwindFramePointers(PerfSymbolTable *symbols)
+{
+    if (m_architecture >= PerfRegisterInfo::ARCH_INVALID)
+        return false;
+
+    const PerfRecordSample *sample = m_currentUnwind.sample;
+    const int fpRegister = PerfRegisterInfo::s_perfFp[m_architecture];
+    const int spRegister = PerfRegisterInfo::s_perfSp[m_architecture];
+    if (!sample->hasRegister(fpRegister) || !sample->hasRegister(spRegister))
+        return false;
+
+    // Not all architectures have their word width set up.
+    const int wordWidth = PerfRegisterInfo::s_wordWidth[m_architecture][registerAbi(sample)];
+    if (wordWidth == 0)
+        return false;
+
+    const QByteArray &stack = sample->userStack();
+    const quint64 start = sample->registerValue(spRegister);
+    const quint64 end = start + static_cast<quint64>(stack.size());
+
+    auto lookupFrame = [&](quint64 pc) -> bool {
+        if (m_currentUnwind.maxFrames != -1
+                && m_currentUnwind.frames.length() > m_currentUnwind.maxFrames) {
+            m_currentUnwind.firstGuessedFrame = m_currentUnwind.frames.length();
+            return false;
+        }
+        bool isInterworking = false;
+        m_currentUnwind.frames.append(symbols->lookupFrame(pc, false, &isInterworking));
+        return !symbols->cacheIsDirty();
+    };
+
+    // The sampled function may not have set up its frame, yet. Then we miss its caller, just like
+    // perf's own frame pointer callchains do.
+    if (!lookupFrame(sample->registerValue(PerfRegisterInfo::s_perfIp[m_architecture])))
+        return true;
+
+    quint64 fp = sample->registerValue(fpRegister);
+    for (int numRecords = 0; ; ++numRecords) {
+        // The outermost frame clears the frame pointer.
+        if (fp == 0)
+            return true;
+
+        // If we've run past the end of the stack snapshot, DWARF wouldn't find more frames either.
+        // If we didn't even find the first frame record there, the frame pointer register is
+        // probably used for something else.
+        if (fp >= end || fp + 2 * static_cast<quint64>(wordWidth) > end)
+            return numRecords > 0;
+
+        if (fp < start || fp % wordWidth != 0)
+            return false;
+
+        Dwarf_Word nextFp = 0;
+        Dwarf_Word returnAddress = 0;
+        doMemcpy(&nextFp, stack.constData() + (fp - start), wordWidth);
+        doMemcpy(&returnAddress, stack.constData() + (fp - start + wordWidth), wordWidth);
+        if (returnAddress == 0)
+            return true;
+
+        // Return addresses have to be mapped, and the stack grows down.
+        if (!symbols->findElf(returnAddress).isValid() || (nextFp != 0 && nextFp <= fp))
+            return false;
+
+        // Look up the call instruction, not the one after it.
+        if (!lookupFrame(returnAddress - 1))
+            return true;
+
+        fp = nextFp;
+    }
+}
+
+bool PerfUnwind::unwindCfi(PerfSymbolTable *symbols)
+{
+    if (m_architecture >= PerfRegisterInfo::ARCH_INVALID)
+        return false;
+
+    const PerfRecordSample *sample = m_currentUnwind.sample;
+    const auto abi = registerAbi(sample);
+    const int numRegisters = PerfRegisterInfo::s_numRegisters[m_architecture][abi];
+    const int spRegister = PerfRegisterInfo::s_dwarfSp[m_architecture][abi];
+    const int fpRegister = PerfRegisterInfo::s_dwarfFp[m_architecture][abi];
+    if (spRegister >= numRegisters || fpRegister >= numRegisters)
+        return false;
+
+    // The registers of the current frame in DWARF layout. Beyond the first frame, we only know the
+    // stack pointer, the frame pointer and the return address register.
+    QVarLengthArray<Dwarf_Word, 64> registers(numRegisters);
+    quint64 knownRegisters = 0;
+    for (int i = 0; i < numRegisters; ++i) {
+        const int perfRegister = PerfRegisterInfo::s_perfToDwarf[m_architecture][abi][i];
+        if (sample->hasRegister(perfRegister)) {
+            registers[i] = sample->registerValue(perfRegister);
+            knownRegisters |= 1ull << i;
+        }
+    }
+    auto isKnown = [&](int reg) {
+        return reg < numRegisters && (knownRegisters & (1ull << reg));
+    };
+    if (!isKnown(spRegister))
+        return false;
+
+    const int wordWidth = PerfRegisterInfo::s_wordWidth[m_architecture][abi];
+    if (wordWidth == 0)
+        return false;
+
+    const QByteArray &stack = sample->userStack();
+    const quint64 stackStart = registers[spRegister];
+    const quint64 stackEnd = stackStart + static_cast<quint64>(stack.size());
+    auto readStack = [&](quint64 address, Dwarf_Word *value) {
+        if (address < stackStart || address >= stackEnd
+                || address + static_cast<quint64>(wordWidth) > stackEnd) {
+            return false;
+        }
+        doMemcpy(value, stack.constData() + (address - stackStart), wordWidth);
+        return true;
+    };
+
+    Dwarf_Addr pc = sample->registerValue(PerfRegisterInfo::s_perfIp[m_architecture]);
+    bool isActivation = true;
+    while (true) {
+        if (m_currentUnwind.maxFrames != -1
+                && m_currentUnwind.frames.length() > m_currentUnwind.maxFrames) {
+            m_currentUnwind.firstGuessedFrame = m_currentUnwind.frames.length();
+            return true;
+        }
+
+        const Dwarf_Addr pcAdjusted = pc - (isActivation ? 0 : 1);
+        bool isInterworking = false;
+        m_currentUnwind.frames.append(symbols->lookupFrame(pcAdjusted, false, &isInterworking));
+        Dwfl_Module *module = symbols->module(pcAdjusted);
+        if (symbols->cacheIsDirty())
+            return true; // analyze() will try again
+
+        Dwarf_Addr moduleStart = 0;
+        const auto *row = module ? symbols->cfiTable(module, &moduleStart)
+                                           ->findRow(module, moduleStart, pcAdjusted, fpRegister)
+                                 : nullptr;
+        if (!row || row->isComplex || !isKnown(row->cfaRegister))
+            return false;
+
+        const Dwarf_Word cfa = registers[row->cfaRegister] + static_cast<Dwarf_Word>(row->cfaOffset);
+        auto apply = [&](const PerfCfiTable::Rule &rule, int reg, Dwarf_Word *value) {
+            if (rule.kind == PerfCfiTable::Rule::SameValue && isKnown(reg)) {
+                *value = registers[reg];
+                return true;
+            } else if (rule.kind == PerfCfiTable::Rule::CfaOffset) {
+                return readStack(cfa + static_cast<Dwarf_Word>(rule.offset), value);
+            }
+            return false;
+        };
+
+        // An undefined return address marks the outermost frame.
+        if (row->returnAddress.kind == PerfCfiTable::Rule::Undefined)
+            return true;
+
+        Dwarf_Word returnAddress = 0;
+        if (!apply(row->returnAddress, row->returnAddressRegister, &returnAddress)) {
+            // If it's saved beyond the stack snapshot, DWARF can't find it either.
+            return row->returnAddress.kind == PerfCfiTable::Rule::CfaOffset;
+        }
+        if (returnAddress == 0)
+            return true;
+
+        // The stack grows down, if the CFA doesn't we'd be going in circles.
+        if (cfa <= registers[spRegister])
+            return false;
+
+        Dwarf_Word framePointer = 0;
+        const bool isFramePointerKnown = apply(row->framePointer, fpRegister, &framePointer);
+
+        knownRegisters = 1ull << spRegister;
+        registers[spRegister] = cfa;
+        if (isFramePointerKnown) {
+            registers[fpRegister] = framePointer;
+            knownRegisters |= 1ull << fpRegister;
+        }
+        if (row->returnAddressRegister < numRegisters) {
+            registers[row->returnAddressRegister] = returnAddress;
+            knownRegisters |= 1ull << row->returnAddressRegister;
+        }
+
+        pc = returnAddress;
+        isActivation = false;
+    }
+}
+
+void PerfUnwind::lookupUnwoundStack(const PendingSample &pending)
+{
+    PerfSymbolTable *symbols = symbolTable(m_currentUnwind.sample->pid());
+    const int numCallchainFrames = m_currentUnwind.frames.length();
+
+    for (Dwarf_Addr pc : pending.framePcs) {
+        // Apply the frame limit the same way frameCallback does it.
+        if (m_currentUnwind.maxFrames != -1 && m_currentUnwind.frames.length() > m_currentUnwind.maxFrames) {
+            m_currentUnwind.firstGuessedFrame = m_currentUnwind.frames.length();
+            return;
+        }
+
+        // isKernel = false as unwinding generally only works on user code
+        bool isInterworking = false;
+        const auto frame = symbols->lookupFrame(pc, false, &isInterworking);
+        if (symbols->cacheIsDirty())
+            return;
+        m_currentUnwind.frames.append(frame);
+    }
+
+    if (pending.firstGuessedFrame != -1)
+        m_currentUnwind.firstGuessedFrame = numCallchainFrames + pending.firstGuessedFrame;
+
+    m_currentUnwind.usedStackValues = pending.usedStackValues;
+    if (m_unwindCache.maxCost() > 0)
+        cacheUnwoundStack(symbols, numCallchainFrames);
+}
+
+void PerfUnwind::cacheUnwoundStack(PerfSymbolTable *symbols, int numPrecedingFrames)
+{
+    // Values guessed from earlier samples may be different next time.
+    if (symbols->cacheIsDirty() || m_currentUnwind.usedStackValues)
+        return;
+
+    auto *cached = new CachedUnwind;
+    cached->frames = m_currentUnwind.frames.mid(numPrecedingFrames);
+    if (m_currentUnwind.firstGuessedFrame != -1)
+        cached->firstGuessedFrame = m_currentUnwind.firstGuessedFrame - numPrecedingFrames;
+    cached->numPrecedingFrames = numPrecedingFrames;
+
+    // The sample's stack may point into the mapped perf.data file or be released with the
+    // sample. Keep a copy of it.
+    UnwindKey key(symbols->unwindCacheId(), *m_currentUnwind.sample, currentStackHash());
+    key.stack = QByteArray(key.stack.constData(), key.stack.size());
+    const int cost = static_cast<int>(sizeof(UnwindKey) + sizeof(CachedUnwind))
+            + key.stack.size() + key.registers.size() * static_cast<int>(sizeof(quint64))
+            + cached->frames.size() * static_cast<int>(sizeof(qint32));
+    m_unwindCache.insert(key, cached, cost);
+}
+
+uint PerfUnwind::currentStackHash()
+{
+    if (!m_hasCurrentStackHash) {
+        m_currentStackHash = UnwindKey::hashStack(m_currentUnwind.sample->userStack());
+        m_hasCurrentStackHash = true;
     }
+    return m_currentStackHash;
 }
 
 void PerfUnwind::resolveCallchain()
@@ -649,7 +1026,50 @@ void PerfUnwind::resolveCallchain()
 
 void PerfUnwind::sample(const PerfRecordSample &sample)
 {
-    bufferEvent(sample, &m_sampleBuffer, &m_stats.numSamplesInRound);
+    // Samples of CPUs out of range, most likely corrupt ones, share a buffer after all others.
+    const quint32 numCpus = m_numCpus > 0 ? qMin(m_numCpus, s_maxCpus) : s_maxCpus;
+    const auto cpu = static_cast<int>(qMin(sample.cpu(), numCpus));
+    if (cpu >= m_sampleBuffers.size())
+        m_sampleBuffers.resize(cpu + 1);
+
+    BufferedSample buffered{sample, m_nextSampleSequence++};
+    if (sample.ownsUserStack()) {
+        if (!m_maxBufferedStackSize || m_stats.enabled
+                || m_bufferedStackSize + sample.userStack().size() <= m_maxBufferedStackSize
+                || !spillUserStack(&buffered.sample)) {
+            m_bufferedStackSize += sample.userStack().size();
+        }
+    }
+
+    bufferEvent(buffered, &m_sampleBuffers[cpu], &m_stats.numSamplesInRound);
+}
+
+bool PerfUnwind::spillUserStack(PerfRecordSample *sample)
+{
+    const QByteArray &stack = sample->userStack();
+    if (stack.size() > m_stackSpillFile.segmentSize())
+        return false;
+
+    const qint64 offset = m_stackSpillFile.write(stack);
+    if (offset < 0) {
+        qWarning() << "Failed to write stack spill file:" << m_stackSpillFile.errorString()
+                   << "Keeping all stacks in memory.";
+        m_maxBufferedStackSize = 0;
+        return false;
+    }
+
+    sample->setUserStackSpilled(offset);
+    return true;
+}
+
+void PerfUnwind::restoreUserStack(PerfRecordSample *sample)
+{
+    const QByteArray stack = m_stackSpillFile.take(sample->spilledUserStackOffset(),
+                                                   sample->spilledUserStackSize());
+    // unwinding will just stop at the first frame then
+    if (stack.isEmpty())
+        qWarning() << "Failed to read stack spill file:" << m_stackSpillFile.errorString();
+    sample->restoreUserStack(stack);
 }
 
 template<typename Number>
@@ -717,7 +1137,89 @@ QVariant PerfUnwind::readTraceData(const QByteArray &data, const FormatField &fi
     }
 }
 
-void PerfUnwind::analyze(const PerfRecordSample &sample)
+void PerfUnwind::analyzePendingSamples()
+{
+    if (m_pendingSamples.isEmpty())
+        return;
+
+    // ARM needs the symbols of the first frame to detect interworking veneers while unwinding.
+    // Frame pointers are cheap enough to follow in order.
+    if (m_architecture != PerfRegisterInfo::ARCH_ARM && m_unwindMode == DwarfUnwinding) {
+        // Each process has its own dwfl, so we can unwind different processes in parallel. The
+        // samples of one process are unwound in order by the same thread.
+        struct UnwindJob
+        {
+            PerfSymbolTable *symbols = nullptr;
+            UnwindInfo info;
+            QVector<PendingSample *> samples;
+        };
+
+        QHash<qint32, int> jobIndexes;
+        QVector<UnwindJob> jobs;
+        for (auto &pending : m_pendingSamples) {
+            const PerfRecordSample *sample = pending.sample;
+            if (sample->registerAbi() == 0 || sample->userStack().isEmpty())
+                continue;
+
+            // Leave stacks that were unwound before to analyze(), which will find them in the cache.
+            if (m_unwindCache.maxCost() > 0) {
+                pending.stackHash = UnwindKey::hashStack(sample->userStack());
+                pending.hasStackHash = true;
+                const UnwindKey key(symbolTable(sample->pid())->unwindCacheId(), *sample,
+                                    pending.stackHash);
+                if (m_unwindCache.contains(key))
+                    continue;
+            }
+
+            auto jobIt = jobIndexes.find(sample->pid());
+            if (jobIt == jobIndexes.end()) {
+                jobIt = jobIndexes.insert(sample->pid(), jobs.size());
+                UnwindJob job;
+                // create the symbol table here, the unwinding threads must not modify m_symbolTables
+                job.symbols = symbolTable(sample->pid());
+                job.info.unwind = this;
+                job.info.maxFrames = m_currentUnwind.maxFrames;
+                jobs.append(job);
+            }
+            jobs[jobIt.value()].samples.append(&pending);
+        }
+
+        for (auto &job : jobs) {
+            UnwindJob *unwindJob = &job;
+            m_unwindThreadPool.start([unwindJob]() {
+                UnwindInfo *info = &unwindJob->info;
+                for (PendingSample *pending : std::as_const(unwindJob->samples)) {
+                    info->sample = pending->sample;
+                    info->framePcs = &pending->framePcs;
+                    info->firstGuessedFrame = -1;
+                    info->usedStackValues = false;
+
+                    Dwfl *dwfl = unwindJob->symbols->attachDwfl(&threadCallbacks, info);
+                    if (!dwfl)
+                        return;
+
+                    dwfl_getthread_frames(dwfl, pending->sample->pid(), frameCallback, unwindJob->symbols);
+                    if (unwindJob->symbols->cacheIsDirty()) {
+                        // Leave this and the following samples to analyze(), which will retry.
+                        unwindJob->symbols->clearCache();
+                        return;
+                    }
+
+                    pending->firstGuessedFrame = info->firstGuessedFrame;
+                    pending->usedStackValues = info->usedStackValues;
+                    pending->isUnwound = true;
+                }
+            });
+        }
+        m_unwindThreadPool.waitForDone();
+    }
+
+    for (const auto &pending : std::as_const(m_pendingSamples))
+        analyze(*pending.sample, &pending);
+    m_pendingSamples.clear();
+}
+
+void PerfUnwind::analyze(const PerfRecordSample &sample, const PendingSample *pending)
 {
     if (m_stats.enabled) // don't do any time intensive work in stats mode
         return;
@@ -725,6 +1227,9 @@ void PerfUnwind::analyze(const PerfRecordSample &sample)
     PerfSymbolTable *kernelSymbols = symbolTable(s_kernelPid);
     PerfSymbolTable *userSymbols = symbolTable(sample.pid());
 
+    m_hasCurrentStackHash = pending && pending->hasStackHash;
+    m_currentStackHash = m_hasCurrentStackHash ? pending->stackHash : 0;
+
     for (int unwindingAttempt = 0; unwindingAttempt < 2; ++unwindingAttempt) {
         m_currentUnwind.isInterworking = false;
         m_currentUnwind.firstGuessedFrame = -1;
@@ -741,7 +1246,12 @@ void PerfUnwind::analyze(const PerfRecordSample &sample)
         // only try to unwind when resolveCallchain did not dirty the cache
         if (!userDirty && !kernelDirty) {
             if (sample.registerAbi() != 0 && sample.userStack().length() > 0) {
-                unwindStack();
+                // If the stack got unwound already, only look up the frames. When that dirties
+                // the cache, unwind again on the second attempt.
+                if (pending && pending->isUnwound && unwindingAttempt == 0)
+                    lookupUnwoundStack(*pending);
+                else
+                    unwindStack();
                 userDirty = userSymbols->cacheIsDirty();
             } else {
                 break;
@@ -794,15 +1304,14 @@ void PerfUnwind::analyze(const PerfRecordSample &sample)
     QVector<QPair<qint32, quint64>> values;
     const auto readFormats = sample.readFormats();
     if (readFormats.isEmpty()) {
-        values.push_back({ attributesId, sample.period() });
+        values.push_back({ attributesId, sample.period() * m_periodScale });
     } else {
         for (const auto& f : readFormats) {
             values.push_back({ m_attributeIds.value(f.id, -1), f.value });
         }
     }
 
-    QByteArray buffer;
-    QDataStream stream(&buffer, QIODevice::WriteOnly);
+    QDataStream &stream = beginEvent();
     stream << static_cast<quint8>(type) << sample.pid()
            << sample.tid() << sample.time() << sample.cpu() << m_currentUnwind.frames
            << numGuessedFrames << values;
@@ -818,7 +1327,7 @@ void PerfUnwind::analyze(const PerfRecordSample &sample)
         stream << traceData;
     }
 
-    sendBuffer(buffer);
+    endEvent();
 }
 
 void PerfUnwind::fork(const PerfRecordFork &sample)
@@ -837,95 +1346,137 @@ void PerfUnwind::exit(const PerfRecordExit &sample)
 
 void PerfUnwind::sendString(qint32 id, const QByteArray& string)
 {
-    QByteArray buffer;
-    QDataStream(&buffer, QIODevice::WriteOnly) << static_cast<quint8>(StringDefinition)
-                                               << id << string;
-    sendBuffer(buffer);
+    beginEvent() << static_cast<quint8>(StringDefinition)
+                 << id << string;
+    endEvent();
 }
 
 void PerfUnwind::sendLocation(qint32 id, const PerfUnwind::Location &location)
 {
-    QByteArray buffer;
     Q_ASSERT(location.pid);
-    QDataStream(&buffer, QIODevice::WriteOnly) << static_cast<quint8>(LocationDefinition)
-                                               << id << location;
-    sendBuffer(buffer);
+    beginEvent() << static_cast<quint8>(LocationDefinition)
+                 << id << location;
+    endEvent();
 }
 
 void PerfUnwind::sendSymbol(qint32 id, const PerfUnwind::Symbol &symbol)
 {
-    QByteArray buffer;
-    QDataStream(&buffer, QIODevice::WriteOnly) << static_cast<quint8>(SymbolDefinition)
-                                               << id << symbol;
-    sendBuffer(buffer);
+    beginEvent() << static_cast<quint8>(SymbolDefinition)
+                 << id << symbol;
+    endEvent();
 }
 
 void PerfUnwind::sendError(ErrorCode error, const QString &message)
 {
     qWarning().noquote().nospace() << error << ": " << message;
-    QByteArray buffer;
-    QDataStream(&buffer, QIODevice::WriteOnly) << static_cast<quint8>(Error)
-                                               << static_cast<qint32>(error) << message;
-    sendBuffer(buffer);
+    beginEvent() << static_cast<quint8>(Error)
+                 << static_cast<qint32>(error) << message;
+    endEvent();
 }
 
 void PerfUnwind::sendProgress(float percent)
 {
-    QByteArray buffer;
-    QDataStream(&buffer, QIODevice::WriteOnly) << static_cast<quint8>(Progress)
-                                               << percent;
-    sendBuffer(buffer);
+    beginEvent() << static_cast<quint8>(Progress)
+                 << percent;
+    endEvent();
+    // progress is only useful when it's reported right away
+    flushOutput();
 }
 
-void PerfUnwind::sendDebugInfoDownloadProgress(qint32 module, qint32 url, qint64 numerator, qint64 denominator)
+void PerfUnwind::sendDebugInfoDownloadProgress(const QByteArray &module, const QByteArray &url,
+                                               qint64 numerator, qint64 denominator)
 {
-    QByteArray buffer;
-    buffer.reserve(21);
-    QDataStream(&buffer, QIODevice::WriteOnly)
-        << static_cast<quint8>(DebugInfoDownloadProgress) << module << url << numerator << denominator;
-    sendBuffer(buffer);
+    QMutexLocker locker(&m_unwindThreadMutex);
+    const qint32 moduleId = resolveString(module);
+    const qint32 urlId = resolveString(url);
+
+    beginEvent() << static_cast<quint8>(DebugInfoDownloadProgress) << moduleId << urlId << numerator << denominator;
+    endEvent();
+    flushOutput();
 }
 
 qint32 PerfUnwind::resolveString(const QByteArray& string)
 {
     if (string.isEmpty())
         return -1;
-    auto stringIt = m_strings.find(string);
-    if (stringIt == m_strings.end()) {
-        stringIt = m_strings.insert(string, m_strings.size());
-        sendString(stringIt.value(), string);
-    }
-    return stringIt.value();
+    bool inserted = false;
+    const qint32 id = m_strings.insert(string, &inserted);
+    if (inserted)
+        sendString(id, string);
+    return id;
 }
 
 qint32 PerfUnwind::lookupString(const QByteArray &string)
 {
-    return m_strings.value(string, -1);
+    return m_strings.find(string);
+}
+
+qint32 PerfUnwind::resolvePath(qint32 pathId)
+{
+    // -1 is the ID of the empty string, so mark the ones we didn't look up yet with -2
+    while (m_pathStrings.size() <= pathId)
+        m_pathStrings.append(-2);
+
+    qint32 &id = m_pathStrings[pathId];
+    if (id == -2)
+        id = resolveString(m_paths.string(pathId));
+    return id;
 }
 
 int PerfUnwind::lookupLocation(const PerfUnwind::Location &location) const
 {
-    return m_locations.value(location, -1);
+    if (m_locationIndex.isEmpty())
+        return -1;
+    return m_locationIndex.at(locationSlot(location));
 }
 
 int PerfUnwind::resolveLocation(const Location &location)
 {
-    auto symbolLocationIt = m_locations.find(location);
-    if (symbolLocationIt == m_locations.end()) {
-        symbolLocationIt = m_locations.insert(location, m_locations.size());
-        sendLocation(symbolLocationIt.value(), location);
+    // keep the load factor at or below 3/4, like PerfFlatHash
+    if ((m_locations.size() + 1) * 4 > m_locationIndex.size() * 3)
+        rehashLocations(qMax(64, m_locationIndex.size() * 2));
+
+    qint32 &locationId = m_locationIndex[locationSlot(location)];
+    if (locationId < 0) {
+        locationId = m_locations.size();
+        m_locations.append(location);
+        sendLocation(locationId, location);
     }
-    return symbolLocationIt.value();
+    return locationId;
+}
+
+int PerfUnwind::locationSlot(const Location &location) const
+{
+    // Multiply with 2^64 / phi and take the highest bits, see PerfFlatHash.
+    const quint64 hash = static_cast<quint64>(qHash(location)) * Q_UINT64_C(0x9e3779b97f4a7c15);
+    const int mask = m_locationIndex.size() - 1;
+    for (int slot = static_cast<int>(hash >> (64 - m_locationIndexBits)); ;
+         slot = (slot + 1) & mask) {
+        const qint32 locationId = m_locationIndex.at(slot);
+        if (locationId < 0 || m_locations.at(locationId) == location)
+            return slot;
+    }
+}
+
+void PerfUnwind::rehashLocations(int capacity)
+{
+    m_locationIndex = QVector<qint32>(capacity, -1);
+    m_locationIndexBits = qCountTrailingZeroBits(static_cast<uint>(capacity));
+    for (qint32 locationId = 0, end = m_locations.size(); locationId < end; ++locationId)
+        m_locationIndex[locationSlot(m_locations.at(locationId))] = locationId;
 }
 
 bool PerfUnwind::hasSymbol(int locationId) const
 {
-    return m_symbols.contains(locationId);
+    return locationId >= 0 && locationId < m_hasSymbol.size() && m_hasSymbol.at(locationId);
 }
 
 void PerfUnwind::resolveSymbol(int locationId, const PerfUnwind::Symbol &symbol)
 {
-    m_symbols.insert(locationId, symbol);
+    Q_ASSERT(locationId >= 0);
+    if (locationId >= m_hasSymbol.size())
+        m_hasSymbol.resize(locationId + 1);
+    m_hasSymbol[locationId] = true;
     sendSymbol(locationId, symbol);
 }
 
@@ -981,8 +1532,9 @@ void PerfUnwind::finishedRound()
 }
 
 template<typename Event>
-void PerfUnwind::bufferEvent(const Event &event, QList<Event> *buffer, uint *eventCounter)
+void PerfUnwind::bufferEvent(const Event &event, PerfEventBuffer<Event> *buffer, uint *eventCounter)
 {
+    // the buffer is sorted when it gets flushed
     buffer->append(event);
     m_eventBufferSize += event.size();
 
@@ -1011,27 +1563,21 @@ void PerfUnwind::forwardMmapBuffer(QList<PerfRecordMmap>::Iterator &mmapIt,
     }
 }
 
-template<typename T>
-bool sortByTime(const T& lhs, const T& rhs)
-{
-    return lhs.time() < rhs.time();
-}
-
 void PerfUnwind::flushEventBuffer(uint desiredBufferSize)
 {
-    // stable sort here to keep order of events with the same time
-    // esp. when we runtime-attach, we will get lots of mmap events with time 0
-    // which we must not shuffle
-    std::stable_sort(m_mmapBuffer.begin(), m_mmapBuffer.end(), sortByTime<PerfRecord>);
-    std::stable_sort(m_sampleBuffer.begin(), m_sampleBuffer.end(), sortByTime<PerfRecord>);
-    std::stable_sort(m_taskEventsBuffer.begin(), m_taskEventsBuffer.end(), sortByTime<TaskEvent>);
+    for (auto &sampleBuffer : m_sampleBuffers)
+        sampleBuffer.sort();
+    m_mmapBuffer.sort();
+    m_taskEventsBuffer.sort();
 
     if (m_stats.enabled) {
-        for (const auto &sample : std::as_const(m_sampleBuffer)) {
-            if (sample.time() < m_lastFlushMaxTime)
-                ++m_stats.numTimeViolatingSamples;
-            else
-                break;
+        for (const auto &sampleBuffer : std::as_const(m_sampleBuffers)) {
+            for (const auto &buffered : sampleBuffer) {
+                if (buffered.time() < m_lastFlushMaxTime)
+                    ++m_stats.numTimeViolatingSamples;
+                else
+                    break;
+            }
         }
         for (const auto &mmap : std::as_const(m_mmapBuffer)) {
             if (mmap.time() < m_lastFlushMaxTime)
@@ -1056,16 +1602,44 @@ void PerfUnwind::flushEventBuffer(uint desiredBufferSize)
     auto mmapIt = m_mmapBuffer.begin();
     auto mmapEnd = m_mmapBuffer.end();
 
-    auto sampleIt = m_sampleBuffer.begin();
-    auto sampleEnd = m_sampleBuffer.end();
+    // The per-CPU sample buffers are sorted already, merge them with a heap of their first samples
+    struct SampleCursor
+    {
+        quint64 time;
+        quint64 sequence;
+        int cpu;
+    };
+    const auto isLater = [](const SampleCursor &lhs, const SampleCursor &rhs) {
+        return lhs.time > rhs.time || (lhs.time == rhs.time && lhs.sequence > rhs.sequence);
+    };
+    std::vector<SampleCursor> sampleHeap;
+    sampleHeap.reserve(static_cast<size_t>(m_sampleBuffers.size()));
+    for (int cpu = 0; cpu < m_sampleBuffers.size(); ++cpu) {
+        if (!m_sampleBuffers.at(cpu).isEmpty()) {
+            const auto &first = m_sampleBuffers.at(cpu).first();
+            sampleHeap.push_back({first.time(), first.sequence, cpu});
+        }
+    }
+    std::make_heap(sampleHeap.begin(), sampleHeap.end(), isLater);
+    QVector<int> numFlushedSamples(m_sampleBuffers.size(), 0);
+    uint numSamples = 0;
 
     uint bufferSize = m_eventBufferSize;
 
     auto taskEventIt = m_taskEventsBuffer.begin();
     auto taskEventEnd = m_taskEventsBuffer.end();
 
-    for (; m_eventBufferSize > desiredBufferSize && sampleIt != sampleEnd; ++sampleIt) {
-        const quint64 timestamp = sampleIt->time();
+    while (m_eventBufferSize > desiredBufferSize && !sampleHeap.empty()) {
+        const int cpu = sampleHeap.front().cpu;
+        auto &sampleBuffer = m_sampleBuffers[cpu];
+        PerfRecordSample &sample = sampleBuffer[numFlushedSamples[cpu]].sample;
+        const quint64 timestamp = sample.time();
+
+        // Task events and mmaps change the state the pending samples have to be analyzed with.
+        if ((taskEventIt != taskEventEnd && taskEventIt->time() <= timestamp)
+                || (mmapIt != mmapEnd && mmapIt->time() <= timestamp)) {
+            analyzePendingSamples();
+        }
 
         if (timestamp < m_lastFlushMaxTime) {
             if (!violatesTimeOrder) {
@@ -1092,7 +1666,7 @@ void PerfUnwind::flushEventBuffer(uint desiredBufferSize)
             m_lastFlushMaxTime = timestamp;
         }
 
-        for (; taskEventIt != taskEventEnd && taskEventIt->time() <= sampleIt->time();
+        for (; taskEventIt != taskEventEnd && taskEventIt->time() <= timestamp;
              ++taskEventIt) {
             if (!m_stats.enabled) {
                 // flush the mmap buffer on fork events to allow initialization with the correct state
@@ -1112,10 +1686,33 @@ void PerfUnwind::flushEventBuffer(uint desiredBufferSize)
 
         forwardMmapBuffer(mmapIt, mmapEnd, timestamp);
 
-        analyze(*sampleIt);
-        m_eventBufferSize -= sampleIt->size();
+        if (sample.isUserStackSpilled())
+            restoreUserStack(&sample);
+        else if (sample.ownsUserStack())
+            m_bufferedStackSize -= sample.userStack().size();
+
+        if (m_unwindThreads > 1 && !m_stats.enabled) {
+            m_pendingSamples.append({&sample, {}, -1, false});
+            if (m_pendingSamples.size() >= s_maxPendingSamples)
+                analyzePendingSamples();
+        } else {
+            analyze(sample);
+        }
+        m_eventBufferSize -= sample.size();
+
+        // the sample stays in its buffer until the end of the flush, pending samples point to it
+        ++numSamples;
+        std::pop_heap(sampleHeap.begin(), sampleHeap.end(), isLater);
+        sampleHeap.pop_back();
+        if (++numFlushedSamples[cpu] < sampleBuffer.size()) {
+            const auto &next = sampleBuffer.at(numFlushedSamples[cpu]);
+            sampleHeap.push_back({next.time(), next.sequence, cpu});
+            std::push_heap(sampleHeap.begin(), sampleHeap.end(), isLater);
+        }
     }
 
+    analyzePendingSamples();
+
     // also flush task events after samples got depleted
     // this ensures we send all of them, even for situations where the client
     // application is not CPU-heavy but rather sleeps most of the time
@@ -1126,12 +1723,12 @@ void PerfUnwind::flushEventBuffer(uint desiredBufferSize)
         m_eventBufferSize -= taskEventIt->size();
     }
 
+    // don't hold back the events of this flush until the output buffer is full
+    flushOutput();
+
     if (m_stats.enabled) {
         ++m_stats.numBufferFlushes;
-        const auto samples = std::distance(m_sampleBuffer.begin(), sampleIt);
-        Q_ASSERT(samples >= 0 && samples < std::numeric_limits<uint>::max());
-        m_stats.maxSamplesPerFlush = std::max(static_cast<uint>(samples),
-                                              m_stats.maxSamplesPerFlush);
+        m_stats.maxSamplesPerFlush = std::max(numSamples, m_stats.maxSamplesPerFlush);
         const auto mmaps = std::distance(m_mmapBuffer.begin(), mmapIt);
         Q_ASSERT(mmaps >= 0 && mmaps < std::numeric_limits<uint>::max());
         m_stats.maxMmapsPerFlush = std::max(static_cast<uint>(mmaps),
@@ -1142,9 +1739,12 @@ void PerfUnwind::flushEventBuffer(uint desiredBufferSize)
                                                       m_stats.maxTaskEventsPerFlush);
     }
 
-    m_sampleBuffer.erase(m_sampleBuffer.begin(), sampleIt);
-    m_mmapBuffer.erase(m_mmapBuffer.begin(), mmapIt);
-    m_taskEventsBuffer.erase(m_taskEventsBuffer.begin(), taskEventIt);
+    for (int cpu = 0; cpu < m_sampleBuffers.size(); ++cpu) {
+        auto &sampleBuffer = m_sampleBuffers[cpu];
+        sampleBuffer.removeUntil(sampleBuffer.begin() + numFlushedSamples[cpu]);
+    }
+    m_mmapBuffer.removeUntil(mmapIt);
+    m_taskEventsBuffer.removeUntil(taskEventIt);
 
     if (!violatesTimeOrder)
         return;
@@ -1181,8 +1781,7 @@ void PerfUnwind::contextSwitch(const PerfRecordContextSwitch& contextSwitch)
 
 void PerfUnwind::sendTaskEvent(const TaskEvent& taskEvent)
 {
-    QByteArray buffer;
-    QDataStream stream(&buffer, QIODevice::WriteOnly);
+    QDataStream &stream = beginEvent();
     stream << static_cast<quint8>(taskEvent.m_type)
            << taskEvent.m_pid << taskEvent.m_tid
            << taskEvent.m_time << taskEvent.m_cpu;
@@ -1194,5 +1793,5 @@ void PerfUnwind::sendTaskEvent(const TaskEvent& taskEvent)
     else if (taskEvent.m_type == LostDefinition)
         stream << taskEvent.m_payload.value<quint64>();
 
-    sendBuffer(buffer);
+    endEvent();
 }
@@ -21,21 +21,30 @@
 #pragma once
 
 #include "perfdata.h"
+#include "perfeventbuffer.h"
 #include "perfkallsyms.h"
 #include "perfregisterinfo.h"
+#include "perfspillfile.h"
+#include "perfstackvalues.h"
+#include "perfstringtable.h"
 #include "perftracingdata.h"
 #include "perfaddresscache.h"
 
 #include <libdwfl.h>
 
+#include <QBuffer>
 #include <QByteArray>
+#include <QCache>
+#include <QDataStream>
 #include <QDir>
 #include <QHash>
 #include <QIODevice>
 #include <QList>
+#include <QMutex>
 #include <QObject>
 #include <QString>
 #include <QMap>
+#include <QThreadPool>
 #include <QVariant>
 
 #include <limits>
@@ -65,6 +74,14 @@ public:
         InvalidType
     };
 
+    enum UnwindMode {
+        DwarfUnwinding,         // Evaluate the DWARF call frame information with elfutils
+        FramePointerUnwinding,  // Follow the frame pointers saved in the stack snapshot
+        AutoUnwinding,          // Use frame pointers, fall back to DWARF where the chain breaks
+        CfiUnwinding            // Apply simplified call frame information, see PerfCfiTable, and
+                                // fall back to DWARF for rules that need dwfl
+    };
+
     struct Location {
         explicit Location(quint64 address = 0, quint64 relAddr = 0, qint32 file = -1,
                           quint32 pid = 0, qint32 line = 0, qint32 column = 0,
@@ -81,6 +98,35 @@ public:
         qint32 parentLocationId;
     };
 
+    // Identifies samples that unwind to the same frames: same process state, same registers and
+    // same stack contents. The key refers to the sample's stack, the cache keeps a copy of it. The
+    // hash only picks the bucket, equal keys have to have equal stacks.
+    struct UnwindKey
+    {
+        // @p cacheId is PerfSymbolTable::unwindCacheId() of the sample's process. @p stackHash
+        // is hashStack() of the sample's user stack, so that callers looking up the same sample
+        // more than once only hash the stack once.
+        UnwindKey(quint64 cacheId, const PerfRecordSample &sample, uint stackHash);
+        bool operator==(const UnwindKey &other) const;
+
+        static uint hashStack(const QByteArray &stack);
+
+        quint64 cacheId = 0;
+        quint64 registerAbi = 0;
+        QList<quint64> registers;
+        QByteArray stack;
+        uint stackHash = 0;
+    };
+
+    struct CachedUnwind
+    {
+        // The frames found by unwinding, and the index of the first guessed one, or -1. Both
+        // exclude the frames from the callchain that precede them.
+        QVector<qint32> frames;
+        int firstGuessedFrame = -1;
+        int numPrecedingFrames = 0;
+    };
+
     struct Symbol {
         explicit Symbol(qint32 name = -1, quint64 relAddr = 0, quint64 size = 0, qint32 binary = -1, qint32 path = -1, qint32 actualPath = -1,
                         bool isKernel = false, bool isInline = false) :
@@ -98,16 +144,22 @@ public:
     };
 
     struct UnwindInfo {
-        UnwindInfo() : frames(0), unwind(nullptr), sample(nullptr), maxFrames(64),
-            firstGuessedFrame(-1), isInterworking(false) {}
+        UnwindInfo() : frames(0), framePcs(nullptr), unwind(nullptr), sample(nullptr),
+            maxFrames(64), firstGuessedFrame(-1), isInterworking(false), usedStackValues(false) {}
+
+        int numFrames() const { return framePcs ? framePcs->length() : frames.length(); }
 
-        QHash<qint32, QHash<quint64, Dwarf_Word>> stackValues;
         QVector<qint32> frames;
+        // If set, only the program counters of the frames are collected, to be looked up later.
+        QVector<Dwarf_Addr> *framePcs;
         PerfUnwind *unwind;
         const PerfRecordSample *sample;
         int maxFrames;
         int firstGuessedFrame;
         bool isInterworking;
+        // Set if memory that wasn't part of the stack snapshot was guessed from earlier samples,
+        // see PerfSymbolTable::stackValues()
+        bool usedStackValues;
     };
 
     struct Stats
@@ -164,12 +216,21 @@ public:
     QString kallsymsPath() const { return m_kallsymsPath; }
     void setKallsymsPath(const QString &kallsymsPath) { m_kallsymsPath = kallsymsPath; }
 
+    QString symbolCachePath() const { return m_symbolCachePath; }
+    void setSymbolCachePath(const QString &symbolCachePath) { m_symbolCachePath = symbolCachePath; }
+
     bool ignoreKallsymsBuildId() const { return m_ignoreKallsymsBuildId; }
     void setIgnoreKallsymsBuildId(bool ignore) { m_ignoreKallsymsBuildId = ignore; }
 
     uint maxEventBufferSize() const { return m_maxEventBufferSize; }
     void setMaxEventBufferSize(uint size);
 
+    quint64 maxBufferedStackSize() const { return m_maxBufferedStackSize; }
+    void setMaxBufferedStackSize(quint64 size) { m_maxBufferedStackSize = size; }
+
+    uint outputBufferSize() const { return m_outputBufferSize; }
+    void setOutputBufferSize(uint size);
+
     uint targetEventBufferSize() const { return m_targetEventBufferSize; }
     void setTargetEventBufferSize(uint size);
 
@@ -185,6 +246,35 @@ public:
     void setByteOrder(QSysInfo::Endian byteOrder) { m_byteOrder = byteOrder; }
     QSysInfo::Endian byteOrder() const { return m_byteOrder; }
 
+    int unwindThreads() const { return m_unwindThreads; }
+    void setUnwindThreads(int unwindThreads);
+
+    // Maximum size in bytes of the unwinding results remembered for all processes together,
+    // including the copies of their stacks. 0 disables the cache.
+    int unwindCacheSize() const { return static_cast<int>(m_unwindCache.maxCost()); }
+    void setUnwindCacheSize(int unwindCacheSize) { m_unwindCache.setMaxCost(unwindCacheSize); }
+    // A new ID for a symbol table's entries in the unwind cache, see PerfSymbolTable::unwindCacheId()
+    quint64 newUnwindCacheId();
+
+    // The paths of the elfs of all symbol tables. Paths are only interned while registering elfs,
+    // which doesn't happen while the unwinding threads run.
+    PerfStringTable *paths() { return &m_paths; }
+
+    UnwindMode unwindMode() const { return m_unwindMode; }
+    void setUnwindMode(UnwindMode unwindMode) { m_unwindMode = unwindMode; }
+
+    int maxStackValues() const { return m_maxStackValues; }
+    void setMaxStackValues(int maxStackValues) { m_maxStackValues = maxStackValues; }
+
+    // The periods of the samples are multiplied by @p scale before sending them, so that the
+    // costs stay the same when only every scale-th sample is analyzed, see PerfSampleFilter.
+    quint32 periodScale() const { return m_periodScale; }
+    void setPeriodScale(quint32 scale) { m_periodScale = scale; }
+
+    // Print the hit rate of the address cache to stderr when done converting the data.
+    bool printCacheStats() const { return m_printCacheStats; }
+    void setPrintCacheStats(bool print) { m_printCacheStats = print; }
+
     void registerElf(const PerfRecordMmap &mmap);
     void comm(const PerfRecordComm &comm);
     void attr(const PerfRecordAttr &attr);
@@ -203,6 +293,9 @@ public:
 
     qint32 resolveString(const QByteArray &string);
     qint32 lookupString(const QByteArray &string);
+    // Like resolveString() for the path interned as @p pathId in paths(), but only looks up the
+    // string the first time.
+    qint32 resolvePath(qint32 pathId);
 
     void addAttributes(const PerfEventAttributes &attributes, const QByteArray &name,
                        const QList<quint64> &ids);
@@ -224,21 +317,28 @@ public:
     Q_ENUM(ErrorCode)
     void sendError(ErrorCode error, const QString &message);
     void sendProgress(float percent);
-    void sendDebugInfoDownloadProgress(qint32 module, qint32 url, qint64 numerator, qint64 denominator);
+    // May be called from the unwinding threads
+    void sendDebugInfoDownloadProgress(const QByteArray &module, const QByteArray &url,
+                                       qint64 numerator, qint64 denominator);
 
     QString systemRoot() const { return m_systemRoot; }
     QString extraLibsPath() const { return m_extraLibsPath; }
     QString appPath() const { return m_appPath; }
     QString debugPath() const { return m_debugPath; }
     QString perfMapPath() const { return m_customPerfMapPath; }
+    QByteArray buildId(const QByteArray &filePath) const { return m_buildIds.value(filePath); }
     Stats stats() const { return m_stats; }
 
     void finalize()
     {
         finishedRound();
         flushEventBuffer(0);
+        flushOutput();
     }
 
+    // Write all serialized events to the output device
+    void flushOutput();
+
 private:
 
     enum CallchainContext {
@@ -283,8 +383,24 @@ private:
     // Path to a directory containing perf-$pid.map
     QString m_customPerfMapPath;
 
-    QList<PerfRecordSample> m_sampleBuffer;
-    QList<PerfRecordMmap> m_mmapBuffer;
+    // Directory where extracted symbol tables are stored per build-id, empty if disabled
+    QString m_symbolCachePath;
+
+    // Samples are buffered per CPU, as each CPU's ring buffer delivers them mostly in time order.
+    // The sequence number restores the original order of samples with the same time on merging.
+    struct BufferedSample
+    {
+        PerfRecordSample sample;
+        quint64 sequence;
+
+        quint64 time() const { return sample.time(); }
+        quint64 size() const { return sample.size(); }
+    };
+    QVector<PerfEventBuffer<BufferedSample>> m_sampleBuffers;
+    // number of CPUs available while recording, as told by the features, or 0
+    quint32 m_numCpus = 0;
+    quint64 m_nextSampleSequence = 0;
+    PerfEventBuffer<PerfRecordMmap> m_mmapBuffer;
     struct TaskEvent
     {
         qint32 m_pid;
@@ -297,15 +413,27 @@ private:
         quint64 time() const { return m_time; }
         quint64 size() const { return sizeof(TaskEvent); }
     };
-    QList<TaskEvent> m_taskEventsBuffer;
+    PerfEventBuffer<TaskEvent> m_taskEventsBuffer;
+    // paths of the elfs of all symbol tables, see PerfElfMap. The symbol cache of m_addressCache
+    // refers to them, so they have to outlive it.
+    PerfStringTable m_paths;
     QHash<qint32, PerfSymbolTable *> m_symbolTables;
     PerfKallsyms m_kallsyms;
     PerfAddressCache m_addressCache;
     PerfTracingData m_tracingData;
 
-    QHash<QByteArray, qint32> m_strings;
-    QHash<Location, qint32> m_locations;
-    QHash<qint32, Symbol> m_symbols;
+    PerfStringTable m_strings;
+    // string IDs of the paths in m_paths, indexed by path ID
+    QVector<qint32> m_pathStrings;
+    // indexed by location ID
+    QVector<Location> m_locations;
+    // Open addressing hash table of location IDs, -1 marks empty slots. The IDs are looked up in
+    // m_locations when comparing, so that each location is stored only once.
+    QVector<qint32> m_locationIndex;
+    int m_locationIndexBits = 0;
+    // Whether a symbol was sent for a location, indexed by location ID. Symbols are only sent to
+    // the client, we never look at them again.
+    QVector<bool> m_hasSymbol;
     QHash<quint64, qint32> m_attributeIds;
     QVector<PerfEventAttributes> m_attributes;
     QHash<QByteArray, QByteArray> m_buildIds;
@@ -322,10 +450,66 @@ private:
 
     Stats m_stats;
 
+    // Stack snapshots copied into buffered samples, beyond m_maxBufferedStackSize they are written
+    // to m_stackSpillFile and only read back when the sample gets analyzed. 0 means no limit.
+    quint64 m_bufferedStackSize = 0;
+    quint64 m_maxBufferedStackSize = 0;
+    PerfSpillFile m_stackSpillFile;
+
+    // Events are serialized into m_outputBuffer and written to m_output in blocks of at least
+    // m_outputBufferSize bytes. m_eventStart is the position of the size of the current event.
+    QByteArray m_outputBuffer;
+    QBuffer m_outputBufferDevice;
+    QDataStream m_outputStream;
+    int m_eventStart = -1;
+    uint m_outputBufferSize = 1 << 20;
+
+    // Samples whose stacks can be unwound in parallel, before looking up the frames in order.
+    struct PendingSample
+    {
+        const PerfRecordSample *sample = nullptr;
+        QVector<Dwarf_Addr> framePcs;
+        int firstGuessedFrame = -1;
+        bool isUnwound = false;
+        bool usedStackValues = false;
+        // see UnwindKey::hashStack(), only set if hasStackHash
+        uint stackHash = 0;
+        bool hasStackHash = false;
+    };
+    QVector<PendingSample> m_pendingSamples;
+    int m_unwindThreads = 1;
+    QThreadPool m_unwindThreadPool;
+    // Protects the state shared between the unwinding threads
+    QMutex m_unwindThreadMutex;
+    UnwindMode m_unwindMode = DwarfUnwinding;
+    // Unwinding results of the samples of all processes, the cost of each entry is its size in
+    // bytes. Only accessed from the main thread.
+    QCache<UnwindKey, CachedUnwind> m_unwindCache;
+    // Symbol tables get consecutive IDs in the upper half, see newUnwindCacheId()
+    quint64 m_nextUnwindCacheId = 0;
+    // Maximum number of stack words remembered per process for guessing frames
+    int m_maxStackValues = PerfStackValues::DefaultMaxSize;
+    // hash of the user stack of m_currentUnwind.sample, see currentStackHash()
+    uint m_currentStackHash = 0;
+    bool m_hasCurrentStackHash = false;
+    quint32 m_periodScale = 1;
+    bool m_printCacheStats = false;
+
     void unwindStack();
+    bool unwindFramePointers(PerfSymbolTable *symbols);
+    bool unwindCfi(PerfSymbolTable *symbols);
+    void lookupUnwoundStack(const PendingSample &pending);
+    void cacheUnwoundStack(PerfSymbolTable *symbols, int numPrecedingFrames);
+    // See UnwindKey::hashStack(). The stack of m_currentUnwind.sample is hashed
+    // at most once.
+    uint currentStackHash();
     void resolveCallchain();
-    void analyze(const PerfRecordSample &sample);
-    void sendBuffer(const QByteArray &buffer);
+    void analyze(const PerfRecordSample &sample, const PendingSample *pending = nullptr);
+    void analyzePendingSamples();
+    bool spillUserStack(PerfRecordSample *sample);
+    void restoreUserStack(PerfRecordSample *sample);
+    QDataStream &beginEvent();
+    void endEvent();
     void sendString(qint32 id, const QByteArray &string);
     void sendLocation(qint32 id, const Location &location);
     void sendSymbol(qint32 id, const Symbol &symbol);
@@ -334,7 +518,7 @@ private:
     void sendTaskEvent(const TaskEvent &taskEvent);
 
     template<typename Event>
-    void bufferEvent(const Event &event, QList<Event> *buffer, uint *eventCounter);
+    void bufferEvent(const Event &event, PerfEventBuffer<Event> *buffer, uint *eventCounter);
     void flushEventBuffer(uint desiredBufferSize);
 
     QVariant readTraceData(const QByteArray &data, const FormatField &field, bool byteSwap);
@@ -343,7 +527,14 @@ private:
                            quint64 timestamp);
     void revertTargetEventBufferSize();
     bool hasTracePointAttributes() const;
+    int locationSlot(const Location &location) const;
+    void rehashLocations(int capacity);
 };
 
 uint qHash(const PerfUnwind::Location &location, uint seed = 0);
+uint qHash(const PerfUnwind::UnwindKey &key, uint seed = 0);
 bool operator==(const PerfUnwind::Location &a, const PerfUnwind::Location &b);
+
+QT_BEGIN_NAMESPACE
+Q_DECLARE_TYPEINFO(PerfUnwind::Location, Q_MOVABLE_TYPE);
+QT_END_NAMESPACE
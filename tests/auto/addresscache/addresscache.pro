@@ -12,11 +12,14 @@ include(../../../elfutils.pri)
 SOURCES += \
     tst_addresscache.cpp \
     ../../../app/perfelfmap.cpp \
+    ../../../app/perfstringtable.cpp \
     ../../../app/perfaddresscache.cpp \
     ../../../app/perfdwarfdiecache.cpp
 
 HEADERS += \
     ../../../app/perfelfmap.h \
+    ../../../app/perfflathash.h \
+    ../../../app/perfstringtable.h \
     ../../../app/perfaddresscache.h \
     ../../../app/perfdwarfdiecache.h
 
@@ -20,6 +20,8 @@
 #include <QObject>
 #include <QTest>
 #include <QDebug>
+#include <QRegularExpression>
+#include <QTemporaryDir>
 #include <QTemporaryFile>
 
 #include "perfaddresscache.h"
@@ -30,7 +32,7 @@ class TestAddressCache : public QObject
 private slots:
     void testRelative()
     {
-        PerfElfMap::ElfInfo info_a{{}, 0x100, 100, 0,
+        PerfElfMap::ElfInfo info_a{&m_paths, {}, 0x100, 100, 0,
                                    QByteArrayLiteral("libfoo.so"),
                                    QByteArrayLiteral("/usr/lib/libfoo.so")};
         PerfElfMap::ElfInfo info_b = info_a;
@@ -62,6 +64,52 @@ private slots:
         QCOMPARE(cache.find(PerfElfMap::ElfInfo{}, 0x123, &invalidAddressCache).locationId, -1);
     }
 
+    void testHitCount()
+    {
+        PerfElfMap::ElfInfo info{&m_paths, {}, 0x100, 100, 0,
+                                 QByteArrayLiteral("libfoo.so"),
+                                 QByteArrayLiteral("/usr/lib/libfoo.so")};
+
+        PerfAddressCache cache;
+        PerfAddressCache::OffsetAddressCache invalidAddressCache;
+        QCOMPARE(cache.find(info, 0x110, &invalidAddressCache).locationId, -1);
+        cache.cache(info, 0x110, {42, false}, &invalidAddressCache);
+        QCOMPARE(cache.find(info, 0x110, &invalidAddressCache).locationId, 42);
+        QCOMPARE(cache.find(info, 0x120, &invalidAddressCache).locationId, -1);
+        QCOMPARE(cache.numLookups(), 3ull);
+        QCOMPARE(cache.numHits(), 1ull);
+    }
+
+    void testOffsetAddressCache()
+    {
+        PerfAddressCache::OffsetAddressCache cache;
+        QVERIFY(cache.isEmpty());
+        QVERIFY(!cache.find(0));
+
+        const int numEntries = 10000;
+        for (int i = 0; i < numEntries; ++i)
+            cache[0x400000 + static_cast<quint64>(i) * 4] = {i, (i % 2) == 0};
+        QCOMPARE(cache.size(), numEntries);
+        QVERIFY(cache.capacity() * 3 >= numEntries * 4);
+
+        for (int i = 0; i < numEntries; ++i) {
+            const auto *entry = cache.find(0x400000 + static_cast<quint64>(i) * 4);
+            QVERIFY(entry);
+            QCOMPARE(entry->locationId, i);
+            QCOMPARE(entry->isInterworking, (i % 2) == 0);
+        }
+        QVERIFY(!cache.contains(0x400002));
+        QCOMPARE(cache.value(0x400002).locationId, -1);
+
+        cache.insert(0x400000, {23, false});
+        QCOMPARE(cache.size(), numEntries);
+        QCOMPARE(cache.value(0x400000).locationId, 23);
+
+        cache.clear();
+        QVERIFY(cache.isEmpty());
+        QVERIFY(!cache.contains(0x400000));
+    }
+
     void testSymbolCache()
     {
         const auto libfoo_a = QByteArrayLiteral("/usr/lib/libfoo_a.so");
@@ -85,6 +133,62 @@ private slots:
         QVERIFY(!cache.findSymbol(libfoo_b, 0x100 + 9).isValid());
         QVERIFY(cache.findSymbol(libfoo_a, 0x11a + 1).isValid());
     }
+
+    void testPersistentSymbolCache()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const auto fileName = dir.filePath(QStringLiteral("abcdef.symbols"));
+
+        const PerfAddressCache::SymbolCache symbols = {
+            {0x100, 0x1100, 10, "Foo"}, {0x11a, 0x111a, 0, "FooZ"}, {0x12a, 0x112a, 10, "FooN"}};
+        QVERIFY(PerfAddressCache::saveSymbolCache(fileName, symbols, 0x1000));
+
+        PerfAddressCache::SymbolCache loaded;
+        QVERIFY(PerfAddressCache::loadSymbolCache(fileName, &loaded, -0x1000));
+        QCOMPARE(loaded.size(), symbols.size());
+        for (int i = 0; i < symbols.size(); ++i) {
+            QCOMPARE(loaded[i].offset, symbols[i].offset);
+            QCOMPARE(loaded[i].value, symbols[i].value);
+            QCOMPARE(loaded[i].size, symbols[i].size);
+            QCOMPARE(loaded[i].symname, symbols[i].symname);
+            QVERIFY(!loaded[i].demangled);
+        }
+
+        // a different load bias is applied to all offsets
+        QVERIFY(PerfAddressCache::loadSymbolCache(fileName, &loaded, 0));
+        QCOMPARE(loaded.first().offset, quint64(0x1100));
+
+        QFile truncated(fileName);
+        QVERIFY(truncated.open(QIODevice::ReadWrite));
+        QVERIFY(truncated.resize(truncated.size() - 4));
+        truncated.close();
+        QTest::ignoreMessage(QtWarningMsg, QRegularExpression(QStringLiteral("^Ignoring truncated symbol cache file")));
+        QVERIFY(!PerfAddressCache::loadSymbolCache(fileName, &loaded));
+
+        QVERIFY(!PerfAddressCache::loadSymbolCache(dir.filePath(QStringLiteral("missing.symbols")), &loaded));
+    }
+
+    void testSharedModuleData()
+    {
+        PerfAddressCache cache;
+        const QByteArray idA = QByteArray::fromHex("0123456789abcdef");
+        const QByteArray idB = QByteArray::fromHex("fedcba9876543210");
+
+        const auto rangesA = cache.dieRanges(idA);
+        QVERIFY(rangesA);
+        QVERIFY(!rangesA->hasCus);
+        QCOMPARE(cache.dieRanges(idA), rangesA);
+        QVERIFY(cache.dieRanges(idB) != rangesA);
+
+        const auto cfiA = cache.cfiTable(idA);
+        QVERIFY(cfiA);
+        QCOMPARE(cache.cfiTable(idA), cfiA);
+        QVERIFY(cache.cfiTable(idB) != cfiA);
+    }
+
+private:
+    PerfStringTable m_paths;
 };
 
 QTEST_GUILESS_MAIN(TestAddressCache)
@@ -1,10 +1,16 @@
 TEMPLATE = subdirs
 SUBDIRS = \
     addresscache \
+    dwarfdiecache \
     elfmap \
+    eventbuffer \
     kallsyms \
     perfdata \
     perfstdin \
+    spillfile \
+    stackvalues \
+    stringtable \
+    timeindex \
     finddebugsym
 
 OTHER_FILES += auto.qbs
@@ -0,0 +1,19 @@
+QT += testlib
+QT -= gui
+
+CONFIG += testcase strict_flags warn_on
+
+INCLUDEPATH += ../../../app
+
+TARGET = tst_dwarfdiecache
+
+include(../../../elfutils.pri)
+
+SOURCES += \
+    tst_dwarfdiecache.cpp \
+    ../../../app/perfdwarfdiecache.cpp
+
+HEADERS += \
+    ../../../app/perfdwarfdiecache.h
+
+OTHER_FILES += dwarfdiecache.qbs
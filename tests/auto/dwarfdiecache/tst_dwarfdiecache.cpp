@@ -0,0 +1,155 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com, author Milian Wolff <milian.wolff@kdab.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include <QObject>
+#include <QTest>
+
+#include "perfdwarfdiecache.h"
+
+using Ranges = QVector<QVector<DwarfRange>>;
+Q_DECLARE_METATYPE(Ranges)
+
+namespace {
+// what the CU lookup did before it got an index
+int findLinear(const Ranges &entries, Dwarf_Addr addr)
+{
+    auto it = std::find_if(entries.begin(), entries.end(), [addr](const QVector<DwarfRange> &ranges) {
+        return std::any_of(ranges.begin(), ranges.end(), [addr](DwarfRange range) {
+            return range.contains(addr);
+        });
+    });
+    return it == entries.end() ? -1 : static_cast<int>(std::distance(entries.begin(), it));
+}
+
+DwarfRangeIndex buildIndex(const Ranges &entries)
+{
+    DwarfRangeIndex index;
+    for (int i = 0; i < entries.size(); ++i) {
+        for (const auto &range : entries[i])
+            index.add(range, i);
+    }
+    index.finalize();
+    return index;
+}
+
+// @p numEntries disjunct CUs with two ranges each, interleaved like in a typical LTO-less binary
+Ranges disjunctRanges(uint numEntries)
+{
+    const Dwarf_Addr step = 256;
+    const Dwarf_Addr coldStart = step * numEntries;
+    Ranges entries;
+    entries.reserve(static_cast<int>(numEntries));
+    for (Dwarf_Addr i = 0; i < numEntries; ++i) {
+        entries.append({{i * step, i * step + step - 16},
+                        {coldStart + i * 32, coldStart + i * 32 + 16}});
+    }
+    // the linker doesn't necessarily emit the CUs sorted by address
+    std::reverse(entries.begin(), entries.end());
+    return entries;
+}
+}
+
+class TestDwarfDieCache : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testRangeIndex_data()
+    {
+        QTest::addColumn<Ranges>("entries");
+
+        QTest::newRow("empty") << Ranges{};
+        QTest::newRow("single") << Ranges{{{0x100, 0x200}}};
+        QTest::newRow("empty-range") << Ranges{{{0x100, 0x100}}, {{0x100, 0x110}}};
+        QTest::newRow("disjunct") << disjunctRanges(10);
+        QTest::newRow("overlapping") << Ranges{{{0x150, 0x160}},
+                                               {{0x100, 0x300}},
+                                               {{0x120, 0x180}, {0x400, 0x500}},
+                                               {{0x000, 0x110}}};
+        QTest::newRow("enclosing") << Ranges{{{0x180, 0x190}},
+                                             {{0x000, 0x1000}},
+                                             {{0x100, 0x200}, {0x600, 0x700}},
+                                             {{0x800, 0x900}}};
+    }
+
+    void testRangeIndex()
+    {
+        QFETCH(Ranges, entries);
+
+        const auto index = buildIndex(entries);
+
+        for (Dwarf_Addr addr = 0; addr < 0x1010; addr += 8)
+            QCOMPARE(index.find(addr), findLinear(entries, addr));
+
+        for (const auto &ranges : entries) {
+            for (const auto &range : ranges) {
+                for (auto addr : {range.low - 1, range.low, range.high - 1, range.high})
+                    QCOMPARE(index.find(addr), findLinear(entries, addr));
+            }
+        }
+    }
+
+    void benchFindLinear_data()
+    {
+        QTest::addColumn<uint>("numEntries");
+        QTest::newRow("100") << 100u;
+        QTest::newRow("1000") << 1000u;
+        QTest::newRow("10000") << 10000u;
+        QTest::newRow("50000") << 50000u;
+    }
+
+    void benchFindLinear()
+    {
+        QFETCH(uint, numEntries);
+        const auto entries = disjunctRanges(numEntries);
+        const Dwarf_Addr maxAddr = 256 * numEntries + 32 * numEntries;
+        const Dwarf_Addr addrStep = maxAddr / 997;
+
+        int found = 0;
+        QBENCHMARK {
+            for (Dwarf_Addr addr = 0; addr < maxAddr; addr += addrStep)
+                found += findLinear(entries, addr);
+        }
+        QVERIFY(found != 0);
+    }
+
+    void benchFindIndex_data()
+    {
+        benchFindLinear_data();
+    }
+
+    void benchFindIndex()
+    {
+        QFETCH(uint, numEntries);
+        const auto entries = disjunctRanges(numEntries);
+        const Dwarf_Addr maxAddr = 256 * numEntries + 32 * numEntries;
+        const Dwarf_Addr addrStep = maxAddr / 997;
+        const auto index = buildIndex(entries);
+
+        int found = 0;
+        QBENCHMARK {
+            for (Dwarf_Addr addr = 0; addr < maxAddr; addr += addrStep)
+                found += index.find(addr);
+        }
+        QVERIFY(found != 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestDwarfDieCache)
+
+#include "tst_dwarfdiecache.moc"
@@ -9,9 +9,12 @@ TARGET = tst_elfmap
 
 SOURCES += \
     tst_elfmap.cpp \
-    ../../../app/perfelfmap.cpp
+    ../../../app/perfelfmap.cpp \
+    ../../../app/perfstringtable.cpp
 
 HEADERS += \
-    ../../../app/perfelfmap.h
+    ../../../app/perfelfmap.h \
+    ../../../app/perfflathash.h \
+    ../../../app/perfstringtable.h
 
 OTHER_FILES += elfmap.qbs
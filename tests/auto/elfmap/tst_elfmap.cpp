@@ -45,10 +45,10 @@ private slots:
     {
         const PerfElfMap::ElfInfo invalid;
 
-        PerfElfMap map;
+        PerfElfMap map(&m_paths);
         QVERIFY(map.isEmpty());
 
-        const PerfElfMap::ElfInfo first({}, 100, 10, 0, "foo", "/foo");
+        const PerfElfMap::ElfInfo first(&m_paths, {}, 100, 10, 0, "foo", "/foo");
 
         QVERIFY(registerElf(&map, first).isEmpty());
         QVERIFY(!map.isEmpty());
@@ -59,7 +59,7 @@ private slots:
         QCOMPARE(map.findElf(109), first);
         QCOMPARE(map.findElf(110), invalid);
 
-        const PerfElfMap::ElfInfo second({}, 0, 10, 0, "bar", "/bar");
+        const PerfElfMap::ElfInfo second(&m_paths, {}, 0, 10, 0, "bar", "/bar");
         QVERIFY(registerElf(&map, second).isEmpty());
 
         QCOMPARE(map.findElf(0), second);
@@ -93,29 +93,29 @@ private slots:
         QFileInfo file2(tmpFile2.fileName());
         QCOMPARE(file2.isFile(), secondIsFile);
 
-        PerfElfMap map;
+        PerfElfMap map(&m_paths);
 
-        const PerfElfMap::ElfInfo first(file1, 95, 20, 0);
+        const PerfElfMap::ElfInfo first(&m_paths, file1, 95, 20, 0);
         QVERIFY(registerElf(&map, first).isEmpty());
         QCOMPARE(map.findElf(110), first);
 
-        PerfElfMap::ElfInfo second(file1, 105, 20, 0);
+        PerfElfMap::ElfInfo second(&m_paths, file1, 105, 20, 0);
         QCOMPARE(registerElf(&map, second), QVector<PerfElfMap::ElfInfo>{first});
         if (firstIsFile)
             second.baseAddr = first.addr;
         QCOMPARE(map.findElf(110), second);
 
-        const PerfElfMap::ElfInfo fragment1(file1, 95, 10, 0);
+        const PerfElfMap::ElfInfo fragment1(&m_paths, file1, 95, 10, 0);
         QCOMPARE(map.findElf(97), fragment1);
 
-        const PerfElfMap::ElfInfo third(file2, 100, 20, 0);
+        const PerfElfMap::ElfInfo third(&m_paths, file2, 100, 20, 0);
         QVector<PerfElfMap::ElfInfo> invalidatedByThird = {fragment1, second};
         QCOMPARE(registerElf(&map, third), invalidatedByThird);
         QCOMPARE(map.findElf(110), third);
         QCOMPARE(map.findElf(110), third);
 
-        const PerfElfMap::ElfInfo fragment2(file1, 120, 5, 15);
-        const PerfElfMap::ElfInfo fragment3(file1, 95, 5, 0);
+        const PerfElfMap::ElfInfo fragment2(&m_paths, file1, 120, 5, 15);
+        const PerfElfMap::ElfInfo fragment3(&m_paths, file1, 95, 5, 0);
         QCOMPARE(map.findElf(122), fragment2);
         QCOMPARE(map.findElf(97), fragment3);
     }
@@ -133,17 +133,17 @@ private slots:
 
     void testIsAddressInRange()
     {
-        PerfElfMap map;
+        PerfElfMap map(&m_paths);
         QVERIFY(!map.isAddressInRange(10));
 
-        const PerfElfMap::ElfInfo first({}, 10, 10, 0);
+        const PerfElfMap::ElfInfo first(&m_paths, {}, 10, 10, 0);
         QVERIFY(registerElf(&map, first).isEmpty());
         QVERIFY(!map.isAddressInRange(9));
         QVERIFY(map.isAddressInRange(10));
         QVERIFY(map.isAddressInRange(19));
         QVERIFY(!map.isAddressInRange(20));
 
-        const PerfElfMap::ElfInfo second({}, 30, 10, 0);
+        const PerfElfMap::ElfInfo second(&m_paths, {}, 30, 10, 0);
         QVERIFY(registerElf(&map, second).isEmpty());
         QVERIFY(!map.isAddressInRange(9));
         QVERIFY(map.isAddressInRange(10));
@@ -156,47 +156,79 @@ private slots:
         QVERIFY(map.isAddressInRange(29));
     }
 
+    void testCopyDataFrom()
+    {
+        const PerfElfMap::ElfInfo invalid;
+        PerfElfMap parent(&m_paths);
+        const PerfElfMap::ElfInfo first(&m_paths, {}, 100, 10, 0, "foo", "/foo");
+        QVERIFY(registerElf(&parent, first).isEmpty());
+
+        PerfElfMap child(&m_paths);
+        child.copyDataFrom(&parent);
+        QCOMPARE(child.findElf(105), first);
+
+        // registering the same elf again changes nothing
+        QVERIFY(registerElf(&child, first).isEmpty());
+        QCOMPARE(child.findElf(105), first);
+
+        // the child can diverge from the parent
+        const PerfElfMap::ElfInfo second(&m_paths, {}, 200, 10, 0, "bar", "/bar");
+        QVERIFY(registerElf(&child, second).isEmpty());
+        QCOMPARE(child.findElf(205), second);
+        QCOMPARE(parent.findElf(205), invalid);
+
+        child.updateElf(100, 100, 108);
+        QCOMPARE(child.findElf(109), invalid);
+        QCOMPARE(parent.findElf(109), first);
+
+        // and the parent from the child
+        const PerfElfMap::ElfInfo third(&m_paths, {}, 300, 10, 0, "baz", "/baz");
+        QVERIFY(registerElf(&parent, third).isEmpty());
+        QCOMPARE(parent.findElf(305), third);
+        QCOMPARE(child.findElf(305), invalid);
+    }
+
     void testExtendMapping()
     {
         QTemporaryFile file;
         QVERIFY(file.open());
         const auto fileInfo = QFileInfo(file.fileName());
 
-        PerfElfMap map;
-        const PerfElfMap::ElfInfo first(fileInfo, 0, 5000, 0);
+        PerfElfMap map(&m_paths);
+        const PerfElfMap::ElfInfo first(&m_paths, fileInfo, 0, 5000, 0);
         registerElf(&map, first);
         QCOMPARE(map.findElf(100), first);
 
         // fully contained in the first mapping
-        const PerfElfMap::ElfInfo second(fileInfo, 20, 500, 20);
+        const PerfElfMap::ElfInfo second(&m_paths, fileInfo, 20, 500, 20);
         registerElf(&map, second);
         QCOMPARE(map.findElf(100), first);
 
         // extend the first mapping
-        const PerfElfMap::ElfInfo third(fileInfo, 2000, 8000, 2000);
+        const PerfElfMap::ElfInfo third(&m_paths, fileInfo, 2000, 8000, 2000);
         registerElf(&map, third);
-        const PerfElfMap::ElfInfo extended(fileInfo, 0, 10000, 0);
+        const PerfElfMap::ElfInfo extended(&m_paths, fileInfo, 0, 10000, 0);
         QCOMPARE(map.findElf(100), extended);
         QCOMPARE(map.findElf(2200), extended);
 
         // this has a gap, so don't extend directly
-        PerfElfMap::ElfInfo fourth(fileInfo, 12000, 100, 100);
+        PerfElfMap::ElfInfo fourth(&m_paths, fileInfo, 12000, 100, 100);
         registerElf(&map, fourth);
         QVERIFY(!fourth.hasBaseAddr());
         fourth.baseAddr = 0;
         QVERIFY(fourth.hasBaseAddr());
         QCOMPARE(map.findElf(12000), fourth);
 
-        PerfElfMap::ElfInfo fifth(fileInfo, 2000, 500, 3000);
+        PerfElfMap::ElfInfo fifth(&m_paths, fileInfo, 2000, 500, 3000);
         QVERIFY(!fifth.hasBaseAddr()); // base addr will be set on registering based on first mmap.
         registerElf(&map, fifth);
         fifth.baseAddr = 0;
         QCOMPARE(map.findElf(2200), fifth);
 
-        const PerfElfMap::ElfInfo remainder1(fileInfo, 0, 2000, 0);
+        const PerfElfMap::ElfInfo remainder1(&m_paths, fileInfo, 0, 2000, 0);
         QCOMPARE(map.findElf(100), remainder1);
 
-        const PerfElfMap::ElfInfo remainder2(fileInfo, 2500, 7500, 2500);
+        const PerfElfMap::ElfInfo remainder2(&m_paths, fileInfo, 2500, 7500, 2500);
         QCOMPARE(map.findElf(3000), remainder2);
     }
 
@@ -207,7 +239,7 @@ private slots:
         const quint64 MAX_ADDR = ADDR_STEP * numElfMaps;
         const quint64 LEN = 1024;
         QBENCHMARK {
-            PerfElfMap map;
+            PerfElfMap map(&m_paths);
             for (quint64 addr = 0; addr < MAX_ADDR; addr += ADDR_STEP) {
                 map.registerElf(addr, LEN, 0, {});
             }
@@ -230,7 +262,7 @@ private slots:
         const quint64 MAX_ADDR = ADDR_STEP * numElfMaps;
         quint64 len = MAX_ADDR;
         QBENCHMARK {
-            PerfElfMap map;
+            PerfElfMap map(&m_paths);
             for (quint64 addr = 0; addr < MAX_ADDR; addr += ADDR_STEP, len -= ADDR_STEP) {
                 map.registerElf(addr, len, 0, {});
             }
@@ -250,7 +282,7 @@ private slots:
         const quint64 LEN_STEP = 1024;
         const quint64 MAX_LEN = LEN_STEP * numElfMaps;
         QBENCHMARK {
-            PerfElfMap map;
+            PerfElfMap map(&m_paths);
             for (quint64 len = LEN_STEP; len <= MAX_LEN; len += LEN_STEP) {
                 map.registerElf(ADDR, len, 0, {});
             }
@@ -266,7 +298,7 @@ private slots:
     {
         QFETCH(uint, numElfMaps);
 
-        PerfElfMap map;
+        PerfElfMap map(&m_paths);
 
         const quint64 ADDR_STEP = 1024;
         const quint64 MAX_ADDR = ADDR_STEP * numElfMaps;
@@ -293,7 +325,7 @@ private slots:
     {
         QFETCH(uint, numElfMaps);
 
-        PerfElfMap map;
+        PerfElfMap map(&m_paths);
 
         const quint64 ADDR_STEP = 1024;
         const quint64 MAX_ADDR = ADDR_STEP * numElfMaps;
@@ -320,7 +352,7 @@ private slots:
     {
         QFETCH(uint, numElfMaps);
 
-        PerfElfMap map;
+        PerfElfMap map(&m_paths);
 
         const quint64 FIRST_ADDR = 0;
         const quint64 LEN_STEP = 1024;
@@ -352,11 +384,13 @@ private:
                                   [&invalidated](const PerfElfMap::ElfInfo& other) { // clazy:exclude=lambda-in-connect
                                       invalidated.push_back(other);
                                   });
-        map->registerElf(info.addr, info.length, info.pgoff, info.localFile,
-                         info.originalFileName, info.originalPath);
+        map->registerElf(info.addr, info.length, info.pgoff, info.localFile(),
+                         info.originalFileName(), info.originalPath());
         disconnect(connection);
         return invalidated;
     }
+
+    PerfStringTable m_paths;
 };
 
 QTEST_GUILESS_MAIN(TestElfMap)
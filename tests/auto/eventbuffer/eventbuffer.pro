@@ -0,0 +1,16 @@
+QT += testlib
+QT -= gui
+
+CONFIG += testcase strict_flags warn_on
+
+INCLUDEPATH += ../../../app
+
+TARGET = tst_eventbuffer
+
+SOURCES += \
+    tst_eventbuffer.cpp
+
+HEADERS += \
+    ../../../app/perfeventbuffer.h
+
+OTHER_FILES += eventbuffer.qbs
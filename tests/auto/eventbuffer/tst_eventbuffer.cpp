@@ -0,0 +1,112 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perfeventbuffer.h"
+
+#include <QObject>
+#include <QTest>
+#include <QVector>
+
+namespace {
+struct Event
+{
+    quint64 m_time;
+    int id;
+
+    quint64 time() const { return m_time; }
+};
+
+QVector<int> ids(const PerfEventBuffer<Event> &buffer)
+{
+    QVector<int> result;
+    for (const Event &event : buffer)
+        result.append(event.id);
+    return result;
+}
+}
+
+class TestEventBuffer : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testInterleaved()
+    {
+        // Without a CPU field, the events of all CPUs share one buffer. Within each round, perf
+        // writes the events of one CPU after the other.
+        const int numCpus = 4;
+        const int numRounds = 10;
+        const int numEventsPerRound = 100;
+        PerfEventBuffer<Event> buffer;
+        int id = 0;
+        int size = 0;
+        for (int round = 0; round < numRounds; ++round) {
+            for (int cpu = 0; cpu < numCpus; ++cpu) {
+                for (int i = 0; i < numEventsPerRound; ++i) {
+                    const quint64 time = static_cast<quint64>(round * numEventsPerRound + i)
+                            * numCpus + cpu;
+                    buffer.append({time, id++});
+                }
+            }
+            size += numCpus * numEventsPerRound;
+            QCOMPARE(buffer.size(), size);
+            QVERIFY(!buffer.isSorted());
+            buffer.sort();
+            QVERIFY(buffer.isSorted());
+            QVERIFY(std::is_sorted(buffer.begin(), buffer.end(),
+                                   [](const Event &lhs, const Event &rhs) {
+                                       return lhs.time() < rhs.time();
+                                   }));
+
+            // flush half of the buffer, like PerfUnwind does
+            buffer.removeUntil(buffer.begin() + size / 2);
+            size -= size / 2;
+        }
+    }
+
+    void testStable()
+    {
+        PerfEventBuffer<Event> buffer;
+        buffer.append({0, 0});
+        buffer.append({5, 1});
+        buffer.append({0, 2});
+        buffer.append({5, 3});
+        buffer.append({3, 4});
+        buffer.append({0, 5});
+
+        // events with the same time keep the order they arrived in
+        buffer.sort();
+        QCOMPARE(ids(buffer), (QVector<int>{0, 2, 5, 4, 1, 3}));
+
+        // events appended in order after sorting don't need to be sorted again
+        buffer.append({5, 6});
+        buffer.append({7, 7});
+        QVERIFY(buffer.isSorted());
+
+        buffer.removeUntil(buffer.begin() + 2);
+        buffer.append({4, 8});
+        QVERIFY(!buffer.isSorted());
+        buffer.sort();
+        QCOMPARE(ids(buffer), (QVector<int>{5, 4, 8, 1, 3, 6, 7}));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestEventBuffer)
+
+#include "tst_eventbuffer.moc"
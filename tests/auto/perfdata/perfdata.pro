@@ -14,6 +14,7 @@ SOURCES += \
     tst_perfdata.cpp \
     ../../../app/perfaddresscache.cpp \
     ../../../app/perfattributes.cpp \
+    ../../../app/perfcfitable.cpp \
     ../../../app/perfdata.cpp \
     ../../../app/perfelfmap.cpp \
     ../../../app/perffeatures.cpp \
@@ -21,7 +22,11 @@ SOURCES += \
     ../../../app/perfheader.cpp \
     ../../../app/perfkallsyms.cpp \
     ../../../app/perfregisterinfo.cpp \
+    ../../../app/perfspillfile.cpp \
+    ../../../app/perfstackvalues.cpp \
+    ../../../app/perfstringtable.cpp \
     ../../../app/perfsymboltable.cpp \
+    ../../../app/perftimeindex.cpp \
     ../../../app/perftracingdata.cpp \
     ../../../app/perfunwind.cpp \
     ../../../app/perfdwarfdiecache.cpp \
@@ -30,14 +35,21 @@ SOURCES += \
 HEADERS += \
     ../../../app/perfaddresscache.h \
     ../../../app/perfattributes.h \
+    ../../../app/perfcfitable.h \
     ../../../app/perfdata.h \
     ../../../app/perfelfmap.h \
+    ../../../app/perfeventbuffer.h \
+    ../../../app/perfflathash.h \
     ../../../app/perffeatures.h \
     ../../../app/perffilesection.h \
     ../../../app/perfheader.h \
     ../../../app/perfkallsyms.h \
     ../../../app/perfregisterinfo.h \
+    ../../../app/perfspillfile.h \
+    ../../../app/perfstackvalues.h \
+    ../../../app/perfstringtable.h \
     ../../../app/perfsymboltable.h \
+    ../../../app/perftimeindex.h \
     ../../../app/perftracingdata.h \
     ../../../app/perfunwind.h \
     ../../../app/perfdwarfdiecache.h \
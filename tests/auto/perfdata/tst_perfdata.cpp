@@ -31,6 +31,9 @@
 #include <QRegularExpression>
 #include <QStandardPaths>
 
+Q_DECLARE_METATYPE(PerfSampleFilter)
+Q_DECLARE_METATYPE(PerfUnwind::UnwindMode)
+
 class TestPerfData : public QObject
 {
     Q_OBJECT
@@ -38,8 +41,13 @@ private slots:
     void testTracingData_data();
     void testTracingData();
     void testContentSize();
+    void testSampleFilter_data();
+    void testSampleFilter();
     void testFiles_data();
     void testFiles();
+    void testUnwindModes_data();
+    void testUnwindModes();
+    void testSampleRate();
     void testInlineDetection();
 };
 
@@ -71,12 +79,15 @@ static void setupUnwind(PerfUnwind *unwind, PerfHeader *header, QIODevice *input
     }
 }
 
-static void process(PerfUnwind *unwind, QIODevice *input, const QByteArray &expectedVersion)
+static void process(PerfUnwind *unwind, QIODevice *input, const QByteArray &expectedVersion,
+                    bool decompressAhead = false, const PerfSampleFilter &sampleFilter = {})
 {
     PerfHeader header(input);
     PerfAttributes attributes;
     PerfData data(unwind, &header, &attributes);
     data.setSource(input);
+    data.setDecompressAhead(decompressAhead);
+    data.setSampleFilter(sampleFilter);
 
     QSignalSpy spy(&data, &PerfData::finished);
     QObject::connect(&header, &PerfHeader::finished, &data, [&](){
@@ -216,6 +227,77 @@ void TestPerfData::testContentSize()
     QCOMPARE(unwind.stats().numSamples, 69u);
 }
 
+void TestPerfData::testSampleFilter_data()
+{
+    QTest::addColumn<PerfSampleFilter>("filter");
+    QTest::addColumn<uint>("numSamples");
+
+    // All 69 samples in contentsize.data are from thread 11512 and carry no CPU.
+    PerfSampleFilter all;
+    all.timeFrom = 13159515835089;
+    all.timeTo = 13162514914662;
+    QTest::newRow("all times") << all << 69u;
+
+    PerfSampleFilter early;
+    early.timeTo = 13161000000000;
+    QTest::newRow("early") << early << 36u;
+
+    PerfSampleFilter late;
+    late.timeFrom = 13161000000000;
+    QTest::newRow("late") << late << 33u;
+
+    PerfSampleFilter pid;
+    pid.pids.insert(11512);
+    QTest::newRow("pid") << pid << 69u;
+
+    PerfSampleFilter otherTid;
+    otherTid.tids.insert(11513);
+    QTest::newRow("other tid") << otherTid << 0u;
+
+    PerfSampleFilter cpu;
+    cpu.cpus.insert(1);
+    QTest::newRow("cpu not sampled") << cpu << 69u;
+
+    PerfSampleFilter everySecond;
+    everySecond.sampleRate = 2;
+    QTest::newRow("every second") << everySecond << 35u;
+
+    PerfSampleFilter maxSamples;
+    maxSamples.maxSamples = 10;
+    QTest::newRow("max samples") << maxSamples << 10u;
+
+    PerfSampleFilter decimatedLate;
+    decimatedLate.timeFrom = 13161000000000;
+    decimatedLate.sampleRate = 10;
+    decimatedLate.maxSamples = 3;
+    QTest::newRow("decimated late") << decimatedLate << 3u;
+}
+
+void TestPerfData::testSampleFilter()
+{
+    QFETCH(PerfSampleFilter, filter);
+    QFETCH(uint, numSamples);
+
+    auto run = [](const PerfSampleFilter &filter) {
+        QBuffer output;
+        QFile input(QStringLiteral(":/contentsize.data"));
+        if (!input.open(QIODevice::ReadOnly) || !output.open(QIODevice::WriteOnly))
+            return PerfUnwind::Stats();
+
+        PerfUnwind unwind(&output, QStringLiteral(":/"), QString(), QString(), QString(), {}, true);
+        process(&unwind, &input, QByteArray("0.5"), false, filter);
+        return unwind.stats();
+    };
+
+    const PerfUnwind::Stats unfiltered = run({});
+    QCOMPARE(unfiltered.numSamples, 69u);
+
+    const PerfUnwind::Stats filtered = run(filter);
+    QCOMPARE(filtered.numSamples, numSamples);
+    // the other events are still processed
+    QCOMPARE(filtered.numMmaps, unfiltered.numMmaps);
+}
+
 Q_DECL_UNUSED static void compressFile(const QString& input, const QString& output = QString())
 {
     QVERIFY(!input.isEmpty() && QFile::exists(input));
@@ -257,6 +339,9 @@ static void uncompressFile(const QString& input, const QString& output = QString
 void TestPerfData::testFiles_data()
 {
     QTest::addColumn<QString>("dataFile");
+    QTest::addColumn<int>("unwindThreads");
+    QTest::addColumn<bool>("decompressAhead");
+    QTest::addColumn<quint64>("maxBufferedStackSize");
 
     // to add a new compressed binary, you'd run this test once with a line like the following:
     // compressFile(QFINDTESTDATA("vector_static_clang/vector_static_clang_v8.0.1"));
@@ -276,12 +361,26 @@ void TestPerfData::testFiles_data()
         "parallel_static_gcc/perf.data.zstd",
     };
     for (auto file : files)
-        QTest::addRow("%s", file) << file;
+        QTest::addRow("%s", file) << file << 1 << false << quint64(0);
+
+    // multi-process recordings need to produce the very same output when unwinding in parallel
+    QTest::addRow("fork_static_gcc/perf.data.zstd (parallel unwinding)")
+        << QStringLiteral("fork_static_gcc/perf.data.zstd") << 4 << false << quint64(0);
+
+    QTest::addRow("vector_static_gcc/perf.data.zstd (decompress ahead)")
+        << QStringLiteral("vector_static_gcc/perf.data.zstd") << 1 << true << quint64(0);
+
+    // stacks of compressed data are copied, so this moves nearly all of them to the spill file
+    QTest::addRow("vector_static_gcc/perf.data.zstd (spilled stacks)")
+        << QStringLiteral("vector_static_gcc/perf.data.zstd") << 1 << false << quint64(1);
 }
 
 void TestPerfData::testFiles()
 {
     QFETCH(QString, dataFile);
+    QFETCH(int, unwindThreads);
+    QFETCH(bool, decompressAhead);
+    QFETCH(quint64, maxBufferedStackSize);
 #if !HAVE_ZSTD
     if (dataFile.contains(QStringLiteral("zstd")))
         QSKIP("zstd support disabled, skipping test");
@@ -307,17 +406,19 @@ void TestPerfData::testFiles()
         QVERIFY(input.open(QIODevice::ReadOnly));
         // don't try to parse kallsyms here, it's not the main point and it wouldn't be portable without the mapping file
         // from where we recorded the data. these files are usually large, and we don't want to bloat the repo too much
-        if (QLatin1String(QTest::currentDataTag()) != QLatin1String("fork_static_gcc/perf.data.zstd")) {
+        if (dataFile != QLatin1String("fork_static_gcc/perf.data.zstd")) {
             QTest::ignoreMessage(QtWarningMsg,
                                  QRegularExpression(QStringLiteral(
                                      "Failed to parse kernel symbol mapping file \".+\": Mapping is empty")));
         }
         unwind.setKallsymsPath(QProcess::nullDevice());
+        unwind.setUnwindThreads(unwindThreads);
+        unwind.setMaxBufferedStackSize(maxBufferedStackSize);
 
         auto version = QByteArray("0.5");
         if (dataFile == QLatin1String("parallel_static_gcc/perf.data.zstd"))
             version = "0.6";
-        process(&unwind, &input, version);
+        process(&unwind, &input, version, decompressAhead);
     }
 
     output.close();
@@ -383,6 +484,137 @@ void TestPerfData::testFiles()
     QCOMPARE(actualText, expectedText);
 }
 
+static void unwindFile(const QString &perfDataFile, PerfUnwind::UnwindMode unwindMode,
+                       PerfParserTestClient *client, const PerfSampleFilter &sampleFilter = {})
+{
+    QBuffer output;
+    QVERIFY(output.open(QIODevice::WriteOnly));
+
+    PerfUnwind unwind(&output, QStringLiteral(":/"), QString(), QString(), QFileInfo(perfDataFile).absolutePath());
+    {
+        QFile input(perfDataFile);
+        QVERIFY(input.open(QIODevice::ReadOnly));
+        QTest::ignoreMessage(QtWarningMsg,
+                             QRegularExpression(QStringLiteral(
+                                 "Failed to parse kernel symbol mapping file \".+\": Mapping is empty")));
+        unwind.setKallsymsPath(QProcess::nullDevice());
+        unwind.setUnwindMode(unwindMode);
+        process(&unwind, &input, QByteArray("0.5"), false, sampleFilter);
+    }
+
+    output.close();
+    output.open(QIODevice::ReadOnly);
+    client->extractTrace(&output);
+}
+
+void TestPerfData::testUnwindModes_data()
+{
+    QTest::addColumn<QString>("dataFile");
+    QTest::addColumn<PerfUnwind::UnwindMode>("unwindMode");
+
+    uncompressFile(QFINDTESTDATA("vector_static_clang/vector_static_clang_v8.0.1.zlib"));
+    uncompressFile(QFINDTESTDATA("vector_static_gcc/vector_static_gcc_v9.1.0.zlib"));
+
+    const auto files = {
+        "vector_static_clang/perf.data",
+        "vector_static_gcc/perf.data",
+    };
+    for (auto file : files) {
+        QTest::addRow("%s (cfi)", file) << file << PerfUnwind::CfiUnwinding;
+        QTest::addRow("%s (fp)", file) << file << PerfUnwind::FramePointerUnwinding;
+        QTest::addRow("%s (auto)", file) << file << PerfUnwind::AutoUnwinding;
+    }
+}
+
+void TestPerfData::testUnwindModes()
+{
+    QFETCH(QString, dataFile);
+    QFETCH(PerfUnwind::UnwindMode, unwindMode);
+
+    const auto perfDataFileCompressed = QFINDTESTDATA(dataFile + QLatin1String(".zlib"));
+    QVERIFY(!perfDataFileCompressed.isEmpty() && QFile::exists(perfDataFileCompressed));
+    uncompressFile(perfDataFileCompressed);
+    const auto perfDataFile = QFINDTESTDATA(dataFile);
+
+    PerfParserTestClient dwarf;
+    unwindFile(perfDataFile, PerfUnwind::DwarfUnwinding, &dwarf);
+    PerfParserTestClient actual;
+    unwindFile(perfDataFile, unwindMode, &actual);
+
+    // Location IDs depend on the order of the lookups, so compare addresses.
+    auto addresses = [](const PerfParserTestClient &client, const QVector<qint32> &frames) {
+        QVector<quint64> result;
+        for (qint32 frame : frames)
+            result.append(client.location(frame).address);
+        return result;
+    };
+
+    const auto dwarfSamples = dwarf.samples();
+    const auto actualSamples = actual.samples();
+    QVERIFY(!dwarfSamples.isEmpty());
+    QCOMPARE(actualSamples.size(), dwarfSamples.size());
+
+    for (int i = 0; i < dwarfSamples.size(); ++i) {
+        const auto &dwarfSample = dwarfSamples.at(i);
+        const auto &actualSample = actualSamples.at(i);
+        QCOMPARE(actualSample.time, dwarfSample.time);
+
+        const QVector<quint64> dwarfFrames = addresses(dwarf, dwarfSample.frames);
+        const QVector<quint64> actualFrames = addresses(actual, actualSample.frames);
+        QVERIFY(!actualFrames.isEmpty());
+
+        if (unwindMode == PerfUnwind::CfiUnwinding) {
+            // The frames DWARF found in the stack snapshot have to be found the same way. Beyond
+            // the snapshot DWARF may guess frames from earlier samples, the simplified CFI stops.
+            const int numFound = dwarfFrames.size() - dwarfSample.numGuessedFrames;
+            QVERIFY(actualFrames.size() >= numFound);
+            QCOMPARE(actualFrames.mid(0, numFound), dwarfFrames.mid(0, numFound));
+        } else {
+            // The binaries don't necessarily keep frame pointers, so the chains may end early
+            // or, without a fallback, contain bogus frames. The sampled location is always found.
+            QCOMPARE(actualFrames.first(), dwarfFrames.first());
+        }
+    }
+}
+
+void TestPerfData::testSampleRate()
+{
+    const auto perfDataFileCompressed
+            = QFINDTESTDATA("vector_static_gcc/vector_static_gcc_v9.1.0.zlib");
+    QVERIFY(!perfDataFileCompressed.isEmpty() && QFile::exists(perfDataFileCompressed));
+    uncompressFile(perfDataFileCompressed);
+    const auto perfDataFile = QFINDTESTDATA("vector_static_gcc/perf.data");
+
+    PerfParserTestClient unfiltered;
+    unwindFile(perfDataFile, PerfUnwind::DwarfUnwinding, &unfiltered);
+
+    PerfSampleFilter sampleFilter;
+    sampleFilter.sampleRate = 2;
+    PerfParserTestClient decimated;
+    unwindFile(perfDataFile, PerfUnwind::DwarfUnwinding, &decimated, sampleFilter);
+
+    // Every second sample of each thread and event is kept, with twice the period.
+    QHash<QPair<qint32, qint32>, int> numSamples;
+    QVector<PerfParserTestClient::SampleEvent> expected;
+    for (auto sample : unfiltered.samples()) {
+        QVERIFY(!sample.values.isEmpty());
+        if (numSamples[qMakePair(sample.tid, sample.values.first().first)]++ % 2 != 0)
+            continue;
+        for (auto &value : sample.values)
+            value.second *= 2;
+        expected.append(sample);
+    }
+
+    const auto actual = decimated.samples();
+    QVERIFY(!actual.isEmpty());
+    QCOMPARE(actual.size(), expected.size());
+    for (int i = 0; i < actual.size(); ++i) {
+        QCOMPARE(actual.at(i).tid, expected.at(i).tid);
+        QCOMPARE(actual.at(i).time, expected.at(i).time);
+        QCOMPARE(actual.at(i).values, expected.at(i).values);
+    }
+}
+
 void TestPerfData::testInlineDetection()
 {
     QString perfDataFile = QFINDTESTDATA("cpp-inlining/cpp-inlining.perf.data");
@@ -0,0 +1,17 @@
+QT += testlib
+QT -= gui
+
+CONFIG += testcase strict_flags warn_on
+
+INCLUDEPATH += ../../../app
+
+TARGET = tst_spillfile
+
+SOURCES += \
+    tst_spillfile.cpp \
+    ../../../app/perfspillfile.cpp
+
+HEADERS += \
+    ../../../app/perfspillfile.h
+
+OTHER_FILES += spillfile.qbs
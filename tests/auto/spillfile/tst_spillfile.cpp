@@ -0,0 +1,95 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perfspillfile.h"
+
+#include <QObject>
+#include <QQueue>
+#include <QTest>
+
+namespace {
+QByteArray createData(int i, int size)
+{
+    return QByteArray(size, static_cast<char>('a' + i % 26));
+}
+}
+
+class TestSpillFile : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testWriteTake()
+    {
+        PerfSpillFile file(1000);
+        QVector<qint64> offsets;
+        for (int i = 0; i < 10; ++i) {
+            offsets.append(file.write(createData(i, 100 + i)));
+            QVERIFY(offsets.last() >= 0);
+        }
+
+        // taken in a different order than written
+        for (int i = 9; i >= 0; i -= 2)
+            QCOMPARE(file.take(offsets.at(i), 100 + i), createData(i, 100 + i));
+        for (int i = 0; i < 10; i += 2)
+            QCOMPARE(file.take(offsets.at(i), 100 + i), createData(i, 100 + i));
+
+        // too large for a segment
+        QCOMPARE(file.write(createData(0, 1001)), qint64(-1));
+    }
+
+    void testReusesSegments()
+    {
+        // three arrays per segment, with at most ten of them held at the same time
+        const int segmentSize = 1000;
+        const int size = 300;
+        PerfSpillFile file(segmentSize);
+
+        struct Written
+        {
+            qint64 offset;
+            int i;
+        };
+        QQueue<Written> written;
+        for (int i = 0; i < 1000; ++i) {
+            const qint64 offset = file.write(createData(i, size));
+            QVERIFY(offset >= 0);
+            written.enqueue({offset, i});
+
+            if (written.size() == 10) {
+                // take them back slightly out of order, like samples of different CPUs
+                const Written first = written.dequeue();
+                const Written second = written.dequeue();
+                QCOMPARE(file.take(second.offset, size), createData(second.i, size));
+                QCOMPARE(file.take(first.offset, size), createData(first.i, size));
+            }
+        }
+
+        QVERIFY(file.size() <= 5 * segmentSize);
+
+        while (!written.isEmpty()) {
+            const Written next = written.dequeue();
+            QCOMPARE(file.take(next.offset, size), createData(next.i, size));
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(TestSpillFile)
+
+#include "tst_spillfile.moc"
@@ -0,0 +1,17 @@
+QT += testlib
+QT -= gui
+
+CONFIG += testcase strict_flags warn_on
+
+INCLUDEPATH += ../../../app
+
+TARGET = tst_stackvalues
+
+SOURCES += \
+    tst_stackvalues.cpp \
+    ../../../app/perfstackvalues.cpp
+
+HEADERS += \
+    ../../../app/perfstackvalues.h
+
+OTHER_FILES += stackvalues.qbs
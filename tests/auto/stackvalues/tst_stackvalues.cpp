@@ -0,0 +1,110 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perfstackvalues.h"
+
+#include <QObject>
+#include <QTest>
+
+class TestStackValues : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testInsertFind()
+    {
+        PerfStackValues values;
+        quint64 value = 0;
+        QVERIFY(!values.find(0x1000, &value));
+
+        values.insert(0x1000, 42);
+        values.insert(0x1008, 43);
+        QVERIFY(values.find(0x1000, &value));
+        QCOMPARE(value, 42ull);
+        QVERIFY(values.find(0x1008, &value));
+        QCOMPARE(value, 43ull);
+        QVERIFY(!values.find(0x1010, &value));
+
+        values.insert(0x1000, 44);
+        QVERIFY(values.find(0x1000, &value));
+        QCOMPARE(value, 44ull);
+        QCOMPARE(values.size(), 2);
+    }
+
+    void testGrow()
+    {
+        PerfStackValues values;
+        const quint64 numValues = 10000;
+        for (quint64 i = 0; i < numValues; ++i)
+            values.insert(0x7ffc0000 + i * 8, i);
+
+        // nothing is evicted as long as the table may grow
+        QCOMPARE(values.size(), int(numValues));
+        for (quint64 i = 0; i < numValues; ++i) {
+            quint64 value = 0;
+            QVERIFY(values.find(0x7ffc0000 + i * 8, &value));
+            QCOMPARE(value, i);
+        }
+    }
+
+    void testBounded()
+    {
+        const int maxSize = 1024;
+        PerfStackValues values(maxSize);
+        const quint64 numValues = 100000;
+        for (quint64 i = 0; i < numValues; ++i)
+            values.insert(0x7ffc0000 + i * 8, i);
+
+        QVERIFY(values.size() <= maxSize);
+        QVERIFY(values.capacity() <= maxSize);
+
+        // the most recent value of each set survives
+        quint64 value = 0;
+        QVERIFY(values.find(0x7ffc0000 + (numValues - 1) * 8, &value));
+        QCOMPARE(value, numValues - 1);
+
+        // the oldest ones were evicted
+        QVERIFY(!values.find(0x7ffc0000, &value));
+    }
+
+    void testDisabled()
+    {
+        PerfStackValues values(0);
+        values.insert(0x1000, 42);
+        quint64 value = 0;
+        QVERIFY(!values.find(0x1000, &value));
+        QCOMPARE(values.size(), 0);
+    }
+
+    void testSetMaxSizeClears()
+    {
+        PerfStackValues values;
+        values.insert(0x1000, 42);
+        values.setMaxSize(16);
+        quint64 value = 0;
+        QVERIFY(!values.find(0x1000, &value));
+        values.insert(0x1000, 43);
+        QVERIFY(values.find(0x1000, &value));
+        QCOMPARE(value, 43ull);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestStackValues)
+
+#include "tst_stackvalues.moc"
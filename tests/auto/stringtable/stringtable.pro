@@ -0,0 +1,18 @@
+QT += testlib
+QT -= gui
+
+CONFIG += testcase strict_flags warn_on
+
+INCLUDEPATH += ../../../app
+
+TARGET = tst_stringtable
+
+SOURCES += \
+    tst_stringtable.cpp \
+    ../../../app/perfstringtable.cpp
+
+HEADERS += \
+    ../../../app/perfflathash.h \
+    ../../../app/perfstringtable.h
+
+OTHER_FILES += stringtable.qbs
@@ -0,0 +1,99 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perfstringtable.h"
+
+#include <QObject>
+#include <QTest>
+
+class TestStringTable : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testInsertFind()
+    {
+        PerfStringTable strings;
+        QCOMPARE(strings.find("foo"), -1);
+
+        bool inserted = false;
+        QCOMPARE(strings.insert("foo", &inserted), 0);
+        QVERIFY(inserted);
+        QCOMPARE(strings.insert("bar", &inserted), 1);
+        QVERIFY(inserted);
+        QCOMPARE(strings.insert("foo", &inserted), 0);
+        QVERIFY(!inserted);
+
+        QCOMPARE(strings.find("foo"), 0);
+        QCOMPARE(strings.find("bar"), 1);
+        QCOMPARE(strings.find("baz"), -1);
+        QCOMPARE(strings.size(), 2);
+
+        QCOMPARE(strings.string(0), QByteArray("foo"));
+        QCOMPARE(strings.string(1), QByteArray("bar"));
+        QCOMPARE(strings.string(2), QByteArray());
+
+        // the data can be passed to C APIs
+        QCOMPARE(qstrcmp(strings.string(0).constData(), "foo"), 0);
+        QCOMPARE(qstrcmp(strings.string(1).constData(), "bar"), 0);
+    }
+
+    void testCopiesStrings()
+    {
+        PerfStringTable strings;
+        QByteArray string("/usr/lib/libfoo.so");
+        const QByteArray longString(100000, 'x');
+        {
+            // raw data that goes away after inserting it
+            QByteArray raw = QByteArray::fromRawData(string.constData(), string.size());
+            QCOMPARE(strings.insert(raw), 0);
+            QByteArray rawLong = QByteArray::fromRawData(longString.constData(), longString.size());
+            QCOMPARE(strings.insert(rawLong), 1);
+        }
+        string.fill('y');
+
+        QCOMPARE(strings.string(0), QByteArray("/usr/lib/libfoo.so"));
+        QCOMPARE(strings.find("/usr/lib/libfoo.so"), 0);
+        QCOMPARE(strings.string(1), longString);
+        QCOMPARE(strings.find(longString), 1);
+    }
+
+    void testMany()
+    {
+        PerfStringTable strings;
+        const int numStrings = 100000;
+        for (int i = 0; i < numStrings; ++i)
+            QCOMPARE(strings.insert(QByteArray::number(i)), i);
+        QCOMPARE(strings.size(), numStrings);
+
+        // the strings stay where they are while the table grows
+        for (int i = 0; i < numStrings; ++i) {
+            QCOMPARE(strings.find(QByteArray::number(i)), i);
+            QCOMPARE(strings.string(i), QByteArray::number(i));
+        }
+
+        strings.clear();
+        QCOMPARE(strings.size(), 0);
+        QCOMPARE(strings.find("0"), -1);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestStringTable)
+
+#include "tst_stringtable.moc"
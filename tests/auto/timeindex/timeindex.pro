@@ -0,0 +1,17 @@
+QT += testlib
+QT -= gui
+
+CONFIG += testcase strict_flags warn_on
+
+INCLUDEPATH += ../../../app
+
+TARGET = tst_timeindex
+
+SOURCES += \
+    tst_timeindex.cpp \
+    ../../../app/perftimeindex.cpp
+
+HEADERS += \
+    ../../../app/perftimeindex.h
+
+OTHER_FILES += timeindex.qbs
@@ -0,0 +1,181 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd
+** All rights reserved.
+** For any questions to The Qt Company, please use contact form at http://www.qt.io/contact-us
+**
+** This file is part of the Qt Enterprise Perf Profiler Add-on.
+**
+** GNU General Public License Usage
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation and appearing in
+** the file LICENSE.GPLv3 included in the packaging of this file. Please
+** review the following information to ensure the GNU General Public License
+** requirements will be met: https://www.gnu.org/licenses/gpl.html.
+**
+** If you have questions regarding the use of this file, please use
+** contact form at http://www.qt.io/contact-us
+**
+****************************************************************************/
+
+#include "perftimeindex.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QObject>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+#include <QTest>
+
+namespace {
+// Five rounds of 100 bytes each, with samples at 10-19, 20-29, ... The third round also
+// contains an mmap.
+PerfTimeIndex createIndex()
+{
+    PerfTimeIndex index;
+    for (int i = 0; i < 5; ++i) {
+        const quint64 time = static_cast<quint64>(i + 1) * 10;
+        if (i == 2)
+            index.addStateEvent();
+        index.addSample(time + 9);
+        index.addSample(time);
+        index.finishRound((i + 1) * 100);
+    }
+    return index;
+}
+
+bool operator==(const PerfTimeIndex::Range &a, const PerfTimeIndex::Range &b)
+{
+    return a.begin == b.begin && a.end == b.end && a.statesOnly == b.statesOnly;
+}
+}
+
+class TestTimeIndex : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testBuild()
+    {
+        PerfTimeIndex index = createIndex();
+        QCOMPARE(index.rounds().size(), 5);
+        QCOMPARE(index.rounds().at(1).end, qint64(200));
+        QCOMPARE(index.rounds().at(1).minTime, quint64(20));
+        QCOMPARE(index.rounds().at(1).maxTime, quint64(29));
+        QCOMPARE(index.rounds().at(1).numSamples, 2u);
+        QCOMPARE(index.rounds().at(2).numStateEvents, 1u);
+
+        // empty rounds are dropped
+        index.finishRound(500);
+        QCOMPARE(index.rounds().size(), 5);
+
+        // a round of only state events has no samples
+        index.addStateEvent();
+        index.finishRound(600);
+        QCOMPARE(index.rounds().size(), 6);
+        QVERIFY(!index.rounds().last().hasSamples());
+    }
+
+    void testRanges()
+    {
+        PerfTimeIndex index = createIndex();
+        using Range = PerfTimeIndex::Range;
+
+        // the rounds without state events around the window are skipped altogether
+        QVector<Range> ranges = index.ranges(40, 45);
+        QCOMPARE(ranges.size(), 2);
+        QVERIFY(ranges.at(0) == (Range{200, 300, true}));
+        QVERIFY(ranges.at(1) == (Range{300, 400, false}));
+
+        // everything up to the round after the window
+        ranges = index.ranges(15, 25);
+        QCOMPARE(ranges.size(), 2);
+        QVERIFY(ranges.at(0) == (Range{0, 200, false}));
+        QVERIFY(ranges.at(1) == (Range{200, 300, true}));
+
+        ranges = index.ranges(0, std::numeric_limits<quint64>::max());
+        QCOMPARE(ranges.size(), 1);
+        QVERIFY(ranges.at(0) == (Range{0, 500, false}));
+
+        QVERIFY(index.ranges(100, 200).isEmpty());
+
+        // the rounds of states only are not counted
+        QCOMPARE(index.numSamples(index.ranges(40, 45)), quint64(2));
+        QCOMPARE(index.numSamples(index.ranges(15, 25)), quint64(4));
+        QCOMPARE(index.numSamples(index.ranges(0, std::numeric_limits<quint64>::max())),
+                 quint64(10));
+
+        // samples of unknown time may be in any window
+        index.addUntimedSample();
+        index.finishRound(600);
+        ranges = index.ranges(15, 25);
+        QCOMPARE(ranges.size(), 1);
+        QVERIFY(ranges.at(0) == (Range{0, 600, false}));
+
+        PerfTimeIndex empty;
+        QVERIFY(empty.ranges(0, 100).isEmpty());
+    }
+
+    void testSaveLoad()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString fileName = dir.filePath(QStringLiteral("perf.data.index"));
+        const QString dataFileName = dir.filePath(QStringLiteral("perf.data"));
+
+        QByteArray contents(1500, '\0');
+        for (int i = 0; i < contents.size(); ++i)
+            contents[i] = static_cast<char>(i * 7);
+        QVERIFY(writeFile(dataFileName, contents));
+
+        PerfTimeIndex loaded;
+        QVERIFY(!loaded.load(fileName, dataFileName, 1000, 500));
+
+        const PerfTimeIndex index = createIndex();
+        QVERIFY(index.save(fileName, dataFileName, 1000, 500));
+        QVERIFY(loaded.load(fileName, dataFileName, 1000, 500));
+        QCOMPARE(loaded.rounds().size(), index.rounds().size());
+        for (int i = 0; i < index.rounds().size(); ++i) {
+            QCOMPARE(loaded.rounds().at(i).end, index.rounds().at(i).end);
+            QCOMPARE(loaded.rounds().at(i).minTime, index.rounds().at(i).minTime);
+            QCOMPARE(loaded.rounds().at(i).maxTime, index.rounds().at(i).maxTime);
+            QCOMPARE(loaded.rounds().at(i).numSamples, index.rounds().at(i).numSamples);
+            QCOMPARE(loaded.rounds().at(i).numStateEvents, index.rounds().at(i).numStateEvents);
+        }
+
+        const QRegularExpression different(QStringLiteral("different perf.data file"));
+        QTest::ignoreMessage(QtWarningMsg, different);
+        QVERIFY(!loaded.load(fileName, dataFileName, 1000, 600));
+
+        // a file of the same size, recorded later
+        QFile data(dataFileName);
+        const QDateTime modified = QFileInfo(data).lastModified();
+        QVERIFY(data.open(QIODevice::ReadWrite));
+        QVERIFY(data.setFileTime(modified.addSecs(10), QFileDevice::FileModificationTime));
+        data.close();
+        QTest::ignoreMessage(QtWarningMsg, different);
+        QVERIFY(!loaded.load(fileName, dataFileName, 1000, 500));
+
+        // a file of the same size and time, with the rounds in different places
+        QVERIFY(index.save(fileName, dataFileName, 1000, 500));
+        QVERIFY(loaded.load(fileName, dataFileName, 1000, 500));
+        contents[1000 + 205] = 'x';
+        QVERIFY(writeFile(dataFileName, contents));
+        QVERIFY(data.open(QIODevice::ReadWrite));
+        QVERIFY(data.setFileTime(modified.addSecs(10), QFileDevice::FileModificationTime));
+        data.close();
+        QTest::ignoreMessage(QtWarningMsg, different);
+        QVERIFY(!loaded.load(fileName, dataFileName, 1000, 500));
+    }
+
+private:
+    static bool writeFile(const QString &fileName, const QByteArray &contents)
+    {
+        QFile file(fileName);
+        return file.open(QIODevice::WriteOnly) && file.write(contents) == contents.size();
+    }
+};
+
+QTEST_GUILESS_MAIN(TestTimeIndex)
+
+#include "tst_timeindex.moc"